@@ -0,0 +1,311 @@
+/*
+ * Compact archive for Atorch samples.
+ * The file is a sequence of blocks, each block covers a one minute
+ * partition and has a summary (time range, count, min/max/sum of each field)
+ * followed by the samples, every field is delta coded from the previous
+ * sample as a zigzag varint. Time is stored with ms resolution.
+ * Aggregates over whole blocks are computed from the summaries only.
+ * A block is written when its partition ends or at exit.
+ */
+
+#define ARC_MAGIC "BTGARC02"
+#define ARC_FIELDS 13
+#define ARC_PART_MS (60 * 1000)
+#define ARC_MAX_COUNT 4096
+#define ARC_BUFSIZE (ARC_MAX_COUNT * (ARC_FIELDS + 1) * 5)
+
+typedef struct {
+	char magic[4];
+	uint32_t size, count, reserved;
+	uint64_t t_min, t_max;
+	int32_t min[ARC_FIELDS], max[ARC_FIELDS];
+	int64_t sum[ARC_FIELDS];
+} arc_block_t;
+
+static const struct {
+	const char *name, *text, *unit; int dec;
+} arc_field[ARC_FIELDS] = {
+	{ "vol", "Vol", "V", 2 }, { "cur", "Cur", "A", 2 },
+	{ "cap", "Cap", "mAh", 0 }, { "ene", "Ene", "Wh", 2 },
+	{ "dm", "D-", "V", 2 }, { "dp", "D+", "V", 2 },
+	{ "temp", "CPU", "°C", 0 }, { "dev_time", "Tme", "s", 0 },
+	{ "pow", "Pow", "W", 2 }, { "price", "Price", "", 2 },
+	{ "freq", "Freq", "Hz", 1 }, { "pf", "PF", "", 3 },
+	{ "type", NULL, NULL, 0 }, // report type, no stats
+};
+
+typedef struct {
+	int fd, pos;
+	uint64_t part, prev_time;
+	int32_t prev[ARC_FIELDS];
+	arc_block_t blk;
+	uint8_t buf[ARC_BUFSIZE];
+} arc_writer_t;
+
+static arc_writer_t *atorch_arc;
+
+static void arc_fields(const atorch_data_t *x, int32_t *v) {
+	v[0] = x->vol; v[1] = x->cur;
+	v[2] = x->cap; v[3] = x->ene;
+	v[4] = x->dm; v[5] = x->dp;
+	v[6] = x->temp;
+	v[7] = x->hour * 3600 + x->min * 60 + x->sec;
+	v[8] = x->pow; v[9] = x->price;
+	v[10] = x->freq; v[11] = x->pf;
+	v[12] = x->type;
+}
+
+static void arc_data(const int32_t *v, uint64_t t, atorch_data_t *x) {
+	memset(x, 0, sizeof(*x));
+	x->time = t * 1000;
+	x->vol = v[0]; x->cur = v[1];
+	x->cap = v[2]; x->ene = v[3];
+	x->dm = v[4]; x->dp = v[5];
+	x->temp = v[6];
+	x->hour = (uint32_t)v[7] / 3600;
+	x->min = (uint32_t)v[7] / 60 % 60;
+	x->sec = (uint32_t)v[7] % 60;
+	x->pow = v[8]; x->price = v[9];
+	x->freq = v[10]; x->pf = v[11];
+	x->type = v[12];
+	x->mask = (unsigned)x->type < sizeof(atorch_report) / sizeof(*atorch_report) ?
+			atorch_report[x->type].mask : 0;
+}
+
+/* writes the pending block, which is dropped on a write error (-1) */
+static int arc_write(void) {
+	arc_writer_t *a = atorch_arc;
+	int ret = 0;
+	if (!a || !a->blk.count) return 0;
+	a->blk.size = a->pos;
+	if (write(a->fd, &a->blk, sizeof(a->blk)) != sizeof(a->blk) ||
+			write(a->fd, a->buf, a->pos) != a->pos)
+		ret = -1;
+	a->blk.count = 0;
+	a->pos = 0;
+	return ret;
+}
+
+/* atexit handler, so it reports the error without calling exit() */
+static void arc_flush(void) {
+	unsigned n = atorch_arc ? atorch_arc->blk.count : 0;
+	if (arc_write()) DBG_LOG("archive write failed, %u samples lost\n", n);
+}
+
+static void arc_open(const char *fn) {
+	char magic[8];
+	struct stat st;
+	if (atorch_arc) ERR_EXIT("archive already open\n");
+	if (!(atorch_arc = malloc(sizeof(*atorch_arc))))
+		ERR_EXIT("malloc failed\n");
+	memset(atorch_arc, 0, sizeof(*atorch_arc));
+	atorch_arc->fd = open(fn, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (atorch_arc->fd < 0) PERROR_EXIT(open);
+	if (fstat(atorch_arc->fd, &st) < 0) PERROR_EXIT(fstat);
+	if (!st.st_size) {
+		if (write(atorch_arc->fd, ARC_MAGIC, 8) != 8) PERROR_EXIT(write);
+	} else if (pread(atorch_arc->fd, magic, 8, 0) != 8 || memcmp(magic, ARC_MAGIC, 8))
+		ERR_EXIT("bad archive file\n");
+	atexit(arc_flush);
+	bt_catch_stop();
+}
+
+static void arc_put(uint8_t **pp, int64_t v) {
+	uint64_t u = (uint64_t)v << 1 ^ -(uint64_t)(v < 0);
+	uint8_t *p = *pp;
+	for (; u >= 0x80; u >>= 7) *p++ = u | 0x80;
+	*p++ = u;
+	*pp = p;
+}
+
+static void arc_append(const atorch_data_t *x) {
+	arc_writer_t *a = atorch_arc;
+	arc_block_t *b = &a->blk;
+	int32_t v[ARC_FIELDS];
+	uint64_t t = x->time / 1000;
+	uint8_t *p;
+	int i;
+
+	if (b->count && (t / ARC_PART_MS != a->part || b->count == ARC_MAX_COUNT))
+		if (arc_write()) PERROR_EXIT(write);
+	arc_fields(x, v);
+	if (!b->count) {
+		memset(b, 0, sizeof(*b));
+		memcpy(b->magic, "ARB2", 4);
+		a->part = t / ARC_PART_MS;
+		a->prev_time = 0;
+		memset(a->prev, 0, sizeof(a->prev));
+		b->t_min = t;
+		for (i = 0; i < ARC_FIELDS; i++) b->min[i] = b->max[i] = v[i];
+	}
+	p = a->buf + a->pos;
+	arc_put(&p, t - a->prev_time);
+	for (i = 0; i < ARC_FIELDS; i++) {
+		arc_put(&p, (int64_t)v[i] - a->prev[i]);
+		if (b->min[i] > v[i]) b->min[i] = v[i];
+		if (b->max[i] < v[i]) b->max[i] = v[i];
+		b->sum[i] += v[i];
+		a->prev[i] = v[i];
+	}
+	a->prev_time = t;
+	a->pos = p - a->buf;
+	b->t_max = t;
+	b->count++;
+}
+
+typedef struct {
+	uint8_t *mem; size_t size, pos;
+} arc_reader_t;
+
+static void arc_map(arc_reader_t *r, const char *fn) {
+	struct stat st;
+	int fd = open(fn, O_RDONLY);
+	if (fd < 0) PERROR_EXIT(open);
+	if (fstat(fd, &st) < 0) PERROR_EXIT(fstat);
+	if (st.st_size < 8) ERR_EXIT("bad archive file\n");
+	r->mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (r->mem == MAP_FAILED) PERROR_EXIT(mmap);
+	close(fd);
+	if (memcmp(r->mem, ARC_MAGIC, 8)) ERR_EXIT("bad archive file\n");
+	r->size = st.st_size;
+	r->pos = 8;
+}
+
+/* returns the next block summary, or NULL at the end */
+static const arc_block_t *arc_next(arc_reader_t *r, const uint8_t **data) {
+	static arc_block_t b;
+	if (r->size - r->pos < sizeof(b)) return NULL;
+	memcpy(&b, r->mem + r->pos, sizeof(b));
+	if (memcmp(b.magic, "ARB2", 4) || r->size - r->pos - sizeof(b) < b.size) {
+		DBG_LOG("truncated archive\n");
+		return NULL;
+	}
+	*data = r->mem + r->pos + sizeof(b);
+	r->pos += sizeof(b) + b.size;
+	return &b;
+}
+
+static int64_t arc_get(const uint8_t **pp, const uint8_t *end) {
+	const uint8_t *p = *pp;
+	uint64_t u = 0; int s = 0;
+	while (p < end && *p & 0x80 && s < 63) u |= (uint64_t)(*p++ & 0x7f) << s, s += 7;
+	if (p < end) u |= (uint64_t)*p++ << s;
+	*pp = p;
+	return (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+}
+
+/* decodes the samples of a block within [from, to] (ms) */
+static void arc_decode(const arc_block_t *b, const uint8_t *p,
+		uint64_t from, uint64_t to, void (*cb)(void*, const atorch_data_t*), void *data) {
+	const uint8_t *end = p + b->size;
+	int32_t v[ARC_FIELDS] = { 0 };
+	uint64_t t = 0;
+	unsigned n, i;
+	for (n = 0; n < b->count; n++) {
+		atorch_data_t x;
+		t += arc_get(&p, end);
+		for (i = 0; i < ARC_FIELDS; i++) v[i] += arc_get(&p, end);
+		if (t > to) break;
+		if (t < from) continue;
+		arc_data(v, t, &x);
+		cb(data, &x);
+	}
+}
+
+static void arc_dump_cb(void *data, const atorch_data_t *x) {
+	(void)data;
+	atorch_print(x, ATORCH_PRINT_TIME);
+}
+
+/* times in seconds since the epoch */
+static void arc_dump(const char *fn, double from, double to) {
+	arc_reader_t r;
+	const arc_block_t *b;
+	const uint8_t *p;
+	uint64_t t0 = from * 1e3, t1 = to * 1e3;
+	arc_map(&r, fn);
+	while ((b = arc_next(&r, &p))) {
+		if (b->t_max < t0 || b->t_min > t1) continue;
+		arc_decode(b, p, t0, t1, arc_dump_cb, NULL);
+	}
+	munmap(r.mem, r.size);
+}
+
+typedef struct {
+	uint64_t count, t_min, t_max;
+	int32_t min[ARC_FIELDS], max[ARC_FIELDS];
+	int64_t sum[ARC_FIELDS];
+} arc_stat_t;
+
+static void arc_stat_add(arc_stat_t *s, const arc_block_t *b) {
+	int i;
+	if (!b->count) return;
+	if (!s->count) {
+		s->t_min = b->t_min;
+		for (i = 0; i < ARC_FIELDS; i++) s->min[i] = b->min[i], s->max[i] = b->max[i];
+	}
+	if (s->t_min > b->t_min) s->t_min = b->t_min;
+	if (s->t_max < b->t_max) s->t_max = b->t_max;
+	for (i = 0; i < ARC_FIELDS; i++) {
+		if (s->min[i] > b->min[i]) s->min[i] = b->min[i];
+		if (s->max[i] < b->max[i]) s->max[i] = b->max[i];
+		s->sum[i] += b->sum[i];
+	}
+	s->count += b->count;
+}
+
+static void arc_stat_cb(void *data, const atorch_data_t *x) {
+	arc_block_t b;
+	int i;
+	b.count = 1;
+	b.t_min = b.t_max = x->time / 1000;
+	arc_fields(x, b.min);
+	for (i = 0; i < ARC_FIELDS; i++) b.max[i] = b.min[i], b.sum[i] = b.min[i];
+	arc_stat_add(data, &b);
+}
+
+static void arc_stat(const char *fn, double from, double to) {
+	arc_reader_t r;
+	arc_stat_t s;
+	const arc_block_t *b;
+	const uint8_t *p;
+	uint64_t t0 = from * 1e3, t1 = to * 1e3;
+	unsigned blocks = 0, decoded = 0;
+	int i;
+
+	memset(&s, 0, sizeof(s));
+	arc_map(&r, fn);
+	while ((b = arc_next(&r, &p))) {
+		if (b->t_max < t0 || b->t_min > t1) continue;
+		blocks++;
+		if (b->t_min >= t0 && b->t_max <= t1) arc_stat_add(&s, b);
+		else arc_decode(b, p, t0, t1, arc_stat_cb, &s), decoded++;
+	}
+	munmap(r.mem, r.size);
+
+	out_begin("arcstat", NULL);
+	out_int("count", "count = %u\n", s.count);
+	out_int("blocks", "blocks = %u", blocks);
+	out_int("decoded", " (%u decoded)\n", decoded);
+	out_fix("t_min", "from = %u.%03u\n", s.t_min, 3);
+	out_fix("t_max", "to = %u.%03u\n", s.t_max, 3);
+	for (i = 0; s.count && i < ARC_FIELDS; i++) {
+		static const char * const name[] = { "min", "max", "mean" };
+		char num[16], key[32], fmt[3][64];
+		int64_t v[3];
+		int k;
+		if (!arc_field[i].text) continue;
+		if (arc_field[i].dec) sprintf(num, "%%d.%%0%du", arc_field[i].dec);
+		else strcpy(num, "%d");
+		v[0] = s.min[i]; v[1] = s.max[i];
+		v[2] = (s.sum[i] + (int64_t)s.count / 2) / (int64_t)s.count;
+		sprintf(fmt[0], "%s: min %s", arc_field[i].text, num);
+		sprintf(fmt[1], ", max %s", num);
+		sprintf(fmt[2], ", mean %s %s\n", num, arc_field[i].unit);
+		for (k = 0; k < 3; k++) {
+			sprintf(key, "%s_%s", arc_field[i].name, name[k]);
+			out_fix(key, fmt[k], v[k], arc_field[i].dec);
+		}
+	}
+	out_end(NULL);
+}
@@ -3,75 +3,440 @@
  * Tested: J7-c (USB tester).
  */
 
-static int atorch_handle = 0xc;
+#define ATORCH_MAX_CONN 16
 
-static void atorch_init(btio_t *io) {
+/* per-connection state */
+typedef struct {
+	btio_t *io;
+	int handle, port;
+} atorch_conn_t;
+
+/* stream counters, by port */
+typedef struct {
+	uint64_t reports, samples, malformed, checksum, reasm, other;
+	uint64_t first, last; // us, monotonic
+	hist_t gap; // between samples, us
+} atorch_link_t;
+
+/* single writer, read by the metrics thread */
+#define LINK_ADD(l, name, n) __atomic_store_n(&(l)->name, \
+		(l)->name + (n), __ATOMIC_RELAXED)
+
+static struct {
+	int n;
+	uint64_t interval, next;
+	atorch_link_t port[ATORCH_MAX_CONN];
+} atorch_links;
+
+static void atorch_link_print(void) {
+	int i;
+	for (i = 0; i < atorch_links.n; i++) {
+		const atorch_link_t *l = &atorch_links.port[i];
+		const hist_t *h = &l->gap;
+		uint64_t span = l->last - l->first;
+		out_begin("link", NULL);
+		out_int("port", "port %u:", i);
+		out_int("reports", " reports %u", l->reports);
+		out_int("samples", ", samples %u", l->samples);
+		out_int("malformed", ", malformed %u", l->malformed);
+		out_int("checksum", ", checksum %u", l->checksum);
+		out_int("reasm", ", reassembly %u", l->reasm);
+		out_int("other", ", other %u\n", l->other);
+		out_fix("rate", "  rate %d.%03u/s", span ?
+				(long)((l->samples - 1) * 1000000000 / span) : 0, 3);
+		out_fix("gap_p50", ", gap (ms) p50 %d.%03u", hist_quantile(h, 0.5), 3);
+		out_fix("gap_p90", ", p90 %d.%03u", hist_quantile(h, 0.9), 3);
+		out_fix("gap_p99", ", p99 %d.%03u", hist_quantile(h, 0.99), 3);
+		out_fix("gap_max", ", max %d.%03u\n", h->max, 3);
+		out_end(NULL);
+	}
+}
+
+static void atorch_link_check(void) {
+	uint64_t t;
+	if (!atorch_links.interval) return;
+	t = get_time_us();
+	if (t < atorch_links.next) return;
+	atorch_links.next = t + atorch_links.interval;
+	atorch_link_print();
+}
+
+/* "interval" in seconds, 0 - only at exit */
+static void atorch_link_init(double interval) {
+	atorch_links.interval = interval * 1e6;
+	atorch_links.next = get_time_us() + atorch_links.interval;
+	atexit(atorch_link_print);
+}
+
+static void atorch_init(atorch_conn_t *c) {
 	static const int uuid[] = { 0xffe1 };
+	btio_t *io = c->io;
 	int ret, start, end;
 
 	start = bt_get_type_range(io, 0xffe0, &end);
-	ret = bt_find_char(io, start, end, 1, uuid, &atorch_handle);
+	ret = bt_find_char(io, start, end, 1, uuid, &c->handle);
 	if (ret != 1) ERR_EXIT("can't find char handle\n");
 	if (io->verbose >= 1)
-		DBG_LOG("handle = 0x%x\n", atorch_handle);
-	bt_write_req_desc(io, atorch_handle, end);
+		DBG_LOG("handle = 0x%x\n", c->handle);
+	bt_write_req_desc(io, c->handle, end);
+	if (atorch_links.n <= c->port)
+		__atomic_store_n(&atorch_links.n, c->port + 1, __ATOMIC_RELAXED);
 }
 
-static int atorch_next(btio_t *io) {
-	int len = bt_recv(io);
-	if (len < 3) return -1;
-	if (io->buf[0] != 0x1b) return -1;
-	if (READ16_LE(io->buf + 1) != atorch_handle) return -1;
-	return len - 3;
+static int atorch_checksum(const uint8_t *s, unsigned n) {
+	return (sum8(s, n) ^ 0x44) & 0xff;
 }
 
-static int atorch_checksum(const uint8_t *s, unsigned n) {
-	unsigned c = 0;
-	while (n--) c += *s++;
-	return (c ^ 0x44) & 0xff;
+typedef struct {
+	uint64_t time; // arrival, us since the epoch
+	int vol, cur, cap, ene, dm, dp, temp;
+	int hour, min, sec;
+	int port;
+	int type, mask; // report type, decoded fields
+	int pow, price, freq, pf;
+} atorch_data_t;
+
+/*
+ * Samples are in the USB tester units: 0.01 V, 0.01 A, mAh, 0.01 Wh,
+ * 0.01 W, the AC and DC meter values are scaled to them.
+ */
+enum {
+	ATF_VOL, ATF_CUR, ATF_POW, ATF_CAP, ATF_ENE, ATF_PRICE, ATF_FREQ,
+	ATF_PF, ATF_DM, ATF_DP, ATF_TEMP, ATF_HOUR, ATF_MIN, ATF_SEC, ATF_NUM
+};
+
+static const struct {
+	const char *key, *text; int dec; size_t offset;
+} atorch_field[ATF_NUM] = {
+	{ "vol", "Vol:%d.%02uV\n", 2, offsetof(atorch_data_t, vol) },
+	{ "cur", "Cur:%d.%02uA\n", 2, offsetof(atorch_data_t, cur) },
+	{ "pow", "Pow:%d.%02uW\n", 2, offsetof(atorch_data_t, pow) },
+	{ "cap", "Cap:%dmAh\n", 0, offsetof(atorch_data_t, cap) },
+	{ "ene", "Ene:%d.%02uWh\n", 2, offsetof(atorch_data_t, ene) },
+	{ "price", "Price:%d.%02u\n", 2, offsetof(atorch_data_t, price) },
+	{ "freq", "Freq:%d.%uHz\n", 1, offsetof(atorch_data_t, freq) },
+	{ "pf", "PF:%d.%03u\n", 3, offsetof(atorch_data_t, pf) },
+	{ "dm", "D-:%d.%02uV\n", 2, offsetof(atorch_data_t, dm) },
+	{ "dp", "D+:%d.%02uV\n", 2, offsetof(atorch_data_t, dp) },
+	{ "temp", "CPU:%d\u00b0C\n", 0, offsetof(atorch_data_t, temp) },
+	{ "hour", "Tme:%04u", 0, offsetof(atorch_data_t, hour) },
+	{ "min", "-%02u", 0, offsetof(atorch_data_t, min) },
+	{ "sec", "-%02u\n", 0, offsetof(atorch_data_t, sec) },
+};
+
+/* field, offset from "ff 55", width, value = raw * mul / div (saturated) */
+typedef struct {
+	uint8_t id, off, width, div;
+	uint16_t mul;
+} atorch_desc_t;
+
+#define ATORCH_TIME_DESC \
+	{ ATF_TEMP, 24, 2, 1, 1 }, { ATF_HOUR, 26, 2, 1, 1 }, \
+	{ ATF_MIN, 28, 1, 1, 1 }, { ATF_SEC, 29, 1, 1, 1 }
+
+static const atorch_desc_t atorch_desc_ac[] = {
+	{ ATF_VOL, 4, 3, 1, 10 }, { ATF_CUR, 7, 3, 10, 1 },
+	{ ATF_POW, 10, 3, 1, 10 }, { ATF_ENE, 13, 4, 1, 1000 },
+	{ ATF_PRICE, 17, 3, 1, 1 }, { ATF_FREQ, 20, 2, 1, 1 },
+	{ ATF_PF, 22, 2, 1, 1 }, ATORCH_TIME_DESC
+};
+
+static const atorch_desc_t atorch_desc_dc[] = {
+	{ ATF_VOL, 4, 3, 1, 10 }, { ATF_CUR, 7, 3, 10, 1 },
+	{ ATF_CAP, 10, 3, 1, 10 }, { ATF_ENE, 13, 4, 1, 1000 },
+	{ ATF_PRICE, 17, 3, 1, 1 }, ATORCH_TIME_DESC
+};
+
+static const atorch_desc_t atorch_desc_usb[] = {
+	{ ATF_VOL, 4, 3, 1, 1 }, { ATF_CUR, 7, 3, 1, 1 },
+	{ ATF_CAP, 10, 3, 1, 1 }, { ATF_ENE, 13, 4, 1, 1 },
+	{ ATF_DM, 17, 2, 1, 1 }, { ATF_DP, 19, 2, 1, 1 },
+	{ ATF_TEMP, 21, 2, 1, 1 }, { ATF_HOUR, 23, 2, 1, 1 },
+	{ ATF_MIN, 25, 1, 1, 1 }, { ATF_SEC, 26, 1, 1, 1 },
+};
+
+#define ATORCH_MASK_USB ( \
+	1 << ATF_VOL | 1 << ATF_CUR | 1 << ATF_CAP | 1 << ATF_ENE | \
+	1 << ATF_DM | 1 << ATF_DP | 1 << ATF_TEMP | \
+	1 << ATF_HOUR | 1 << ATF_MIN | 1 << ATF_SEC)
+
+/* indexed by the report type */
+#define ATORCH_MASK_AC ( \
+	1 << ATF_VOL | 1 << ATF_CUR | 1 << ATF_POW | 1 << ATF_ENE | \
+	1 << ATF_PRICE | 1 << ATF_FREQ | 1 << ATF_PF | 1 << ATF_TEMP | \
+	1 << ATF_HOUR | 1 << ATF_MIN | 1 << ATF_SEC)
+
+#define ATORCH_MASK_DC ( \
+	1 << ATF_VOL | 1 << ATF_CUR | 1 << ATF_CAP | 1 << ATF_ENE | \
+	1 << ATF_PRICE | 1 << ATF_TEMP | \
+	1 << ATF_HOUR | 1 << ATF_MIN | 1 << ATF_SEC)
+
+#define ATORCH_DESC(x) x, sizeof(x) / sizeof(*x)
+
+/* indexed by the report type */
+static const struct {
+	const atorch_desc_t *desc; int n, mask;
+} atorch_report[] = {
+	{ NULL, 0, 0 },
+	{ ATORCH_DESC(atorch_desc_ac), ATORCH_MASK_AC },
+	{ ATORCH_DESC(atorch_desc_dc), ATORCH_MASK_DC },
+	{ ATORCH_DESC(atorch_desc_usb), ATORCH_MASK_USB },
+};
+
+#define ATORCH_REPORT_SIZE 36
+
+static inline void atorch_decode_desc(const uint8_t *buf, atorch_data_t *x,
+		const atorch_desc_t *d, int n) {
+#pragma GCC unroll 16
+	for (; n--; d++) {
+		const uint8_t *p = buf + d->off;
+		uint32_t v;
+		uint64_t w;
+		switch (d->width) {
+		case 1: v = p[0]; break;
+		case 2: v = READ16_BE(p); break;
+		case 3: v = READ24_BE(p); break;
+		default: v = READ32_BE(p);
+		}
+		if (d->div > 1) v = (v + d->div / 2) / d->div;
+		/* saturated, a 32-bit energy counter times 1000 doesn't fit */
+		w = (uint64_t)v * d->mul;
+		*(int*)((char*)x + atorch_field[d->id].offset) = w < INT32_MAX ? w : INT32_MAX;
+	}
 }
 
-static void atorch_loop(btio_t *io) {
-	atorch_init(io);
-	io->timeout = 3000;
-	for (;;) {
-		int len, n, chk;
-		len = atorch_next(io);
-		if (len < 3) break;
-		if (io->buf[3] != 0xff || io->buf[4] != 0x55) break;
-		if (io->buf[5] == 0x01) {
-			if (io->buf[6] != 0x03) continue; // USB tester
-			len = bt_recv_more(io, len, n = 4 + 32);
-			if (len != n) break;
-			uint8_t *buf = io->buf + 3;
-			// print_mem(stderr, buf, n);
+/* report of 36 bytes starting from "ff 55", returns 0 for unknown types */
+static int atorch_decode(const uint8_t *buf, atorch_data_t *x) {
+	int type = buf[3];
+	if (type >= (int)(sizeof(atorch_report) / sizeof(*atorch_report)) ||
+			!atorch_report[type].desc) return 0;
+	x->vol = x->cur = x->cap = x->ene = x->dm = x->dp = x->temp = 0;
+	x->hour = x->min = x->sec = 0;
+	x->pow = x->price = x->freq = x->pf = 0;
+	x->type = type;
+	x->mask = atorch_report[type].mask;
+	/* constant tables, so that the compiler can unroll the loop */
+	switch (type) {
+	case 1: atorch_decode_desc(buf, x, ATORCH_DESC(atorch_desc_ac)); break;
+	case 2: atorch_decode_desc(buf, x, ATORCH_DESC(atorch_desc_dc)); break;
+	default: atorch_decode_desc(buf, x, ATORCH_DESC(atorch_desc_usb));
+	}
+	return 1;
+}
+
+/* last sample of each port for other threads, under a seqlock */
+static struct {
+	uint32_t seq;
+	atorch_data_t x;
+} atorch_latest[ATORCH_MAX_CONN];
+
+static void atorch_latest_set(const atorch_data_t *x) {
+	uint32_t *seq = &atorch_latest[x->port].seq, n = *seq;
+	__atomic_store_n(seq, n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	atorch_latest[x->port].x = *x;
+	__atomic_store_n(seq, n + 2, __ATOMIC_RELEASE);
+}
+
+/* returns 0 if there is no sample yet */
+static int atorch_latest_get(int port, atorch_data_t *x) {
+	uint32_t seq;
+	do {
+		while ((seq = __atomic_load_n(&atorch_latest[port].seq, __ATOMIC_ACQUIRE)) & 1);
+		*x = atorch_latest[port].x;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&atorch_latest[port].seq, __ATOMIC_RELAXED) != seq);
+	return seq != 0;
+}
+
+#define ATORCH_PRINT_TIME 1
+#define ATORCH_PRINT_PORT 2
+
+static void atorch_print(const atorch_data_t *x, int flags) {
+	int i;
+	out_begin_at("atorch", "\n", x->time);
+	if (flags & ATORCH_PRINT_TIME)
+		out_text("Time:%u.%06u\n", (unsigned)(x->time / 1000000),
+				(unsigned)(x->time % 1000000));
+	if (flags & ATORCH_PRINT_PORT)
+		out_int("port", "Port:%u\n", x->port);
+	for (i = 0; i < ATF_NUM; i++) {
+		int v;
+		if (!(x->mask >> i & 1)) continue;
+		v = *(const int*)((const char*)x + atorch_field[i].offset);
+		if (!atorch_field[i].dec) out_int(atorch_field[i].key, atorch_field[i].text, v);
+		else out_fix(atorch_field[i].key, atorch_field[i].text, v, atorch_field[i].dec);
+	}
+	out_end(NULL);
+}
+
+#include "ring.h"
+#include "archive.h"
+#include "shm.h"
+#include "summary.h"
+#include "trigger.h"
+
+/*
+ * Returns 1 for a sample, 0 for other or bad frames,
+ * -1 at the end of the stream (timeout).
+ */
+static int atorch_read(atorch_conn_t *c, atorch_data_t *x) {
+	btio_t *io = c->io;
+	atorch_link_t *l = &atorch_links.port[c->port];
+	uint8_t *buf;
+	int len, n, chk;
+	uint64_t t;
+	len = bt_recv(io);
+frame:
+	if (len < 3) return -1;
+	if (io->buf[0] != 0x1b || READ16_LE(io->buf + 1) != c->handle) {
+		LINK_ADD(l, other, 1);
+		return 0;
+	}
+	len -= 3;
+	if (len < 3 || io->buf[3] != 0xff || io->buf[4] != 0x55) {
+		LINK_ADD(l, malformed, 1);
+		return 0;
+	}
+	LINK_ADD(l, reports, 1);
+	if (io->buf[5] != 0x01) return 0;
+	len = bt_recv_more(io, len, n = ATORCH_REPORT_SIZE);
+	if (len != n) {
+		LINK_ADD(l, reasm, 1);
+		/* a fragment was lost, the frame that broke the report may start the next one */
+		if (len < -1 && (len = -1 - len) >= 6 && io->buf[3] == 0xff && io->buf[4] == 0x55)
+			goto frame;
+		return 0;
+	}
+	buf = io->buf + 3;
+	// print_mem(stderr, buf, n);
 /*
 ff 55 01 03 00 01 f3 00 00 06 00 00 28 00 00 00
 01 00 08 00 08 00 12 00 00 05 28 3c 0c 80 00 00
 03 20 00 24
 */
-			chk = atorch_checksum(buf + 3, n - 4);
-			if (buf[n - 1] != chk)
-				ERR_EXIT("bad checksum (expected 0x%02x, got 0x%02x)\n", chk, buf[n - 1]);
-			{
-				DBG_LOG("\n");
-				int vol = READ24_BE(buf + 4);
-				DBG_LOG("Vol:%d.%02uV\n", vol / 100, vol % 100);
-				int cur = READ24_BE(buf + 7);
-				DBG_LOG("Cur:%d.%02uA\n", cur / 100, cur % 100);
-				int cap = READ24_BE(buf + 10);
-				DBG_LOG("Cap:%dmAh\n", cap);
-				int ene = READ32_BE(buf + 13);
-				DBG_LOG("Ene:%d.%02uWh\n", ene / 100, ene % 100);
-				int dm = READ16_BE(buf + 17);
-				DBG_LOG("D-:%d.%02uV\n", dm / 100, dm % 100);
-				int dp = READ16_BE(buf + 19);
-				DBG_LOG("D+:%d.%02uV\n", dp / 100, dp % 100);
-				int cpu = READ16_BE(buf + 0x15);
-				DBG_LOG("CPU:%d\u00b0C\n", cpu);
-				int hour = READ16_BE(buf + 0x17);
-				DBG_LOG("Tme:%04u-%02u-%02u\n", hour, buf[0x19], buf[0x1a]);
-			}
+	chk = atorch_checksum(buf + 3, n - 4);
+	if (buf[n - 1] != chk) {
+		LINK_ADD(l, checksum, 1);
+		if (io->verbose >= 1)
+			DBG_LOG("bad checksum (expected 0x%02x, got 0x%02x)\n", chk, buf[n - 1]);
+		return 0;
+	}
+	timing_mark_once("first_cmd");
+	if (!atorch_decode(buf, x)) return 0;
+	t = get_time_us();
+	if (l->samples) hist_add(&l->gap, t - l->last);
+	else l->first = t;
+	l->last = t;
+	LINK_ADD(l, samples, 1);
+	x->port = c->port;
+	return 1;
+}
+
+static void atorch_loop(btio_t *io) {
+	atorch_conn_t conn = { io, 0xc, 0 };
+	bt_catch_stop();
+	atorch_init(&conn);
+	io->timeout = 3000;
+	for (;;) {
+		atorch_data_t data;
+		int ret;
+		if (bt_stop) break;
+		ret = atorch_read(&conn, &data);
+		if (ret < 0) break;
+		atorch_link_check();
+		if (!ret) continue;
+		data.time = get_time_real_us();
+		atorch_latest_set(&data);
+		if (atorch_ring.hdr) ring_append(&atorch_ring, &data);
+		if (atorch_arc) arc_append(&data);
+		if (atorch_shm) shm_feed_publish(atorch_shm, &data);
+		if (atorch_sum.enabled) sum_update(&data);
+		if (!(atorch_ring.hdr || atorch_arc || atorch_sum.enabled) ||
+				io->verbose >= 1)
+			atorch_print(&data, 0);
+		if (atorch_trig.n) trig_check(&data);
+	}
+}
+
+/* one row with the last sample of each port */
+static void atorch_print_row(uint64_t t, const atorch_data_t *x, int n, unsigned have) {
+	char key[16];
+	int i;
+	out_begin_at("row", NULL, t);
+	out_text("%u.%03u", (unsigned)(t / 1000000), (unsigned)(t / 1000 % 1000));
+	for (i = 0; i < n; i++, x++) {
+		if (!(have >> i & 1)) {
+			out_text(" -");
+			continue;
+		}
+		sprintf(key, "vol%d", i);
+		out_fix(key, " %d.%02uV", x->vol, 2);
+		sprintf(key, "cur%d", i);
+		out_fix(key, "/%d.%02uA", x->cur, 2);
+		sprintf(key, "ene%d", i);
+		out_fix(key, "/%d.%02uWh", x->ene, 2);
+	}
+	out_end("\n");
+}
+
+/*
+ * Follows several testers, frames are timestamped from the monotonic
+ * clock (offset to the real time at start). With "tick" (ms) a row
+ * with the last sample of each port is printed on every tick,
+ * otherwise each sample is printed with its port number.
+ */
+static void atorch_multi(atorch_conn_t *c, int n, int tick) {
+	struct pollfd fds[ATORCH_MAX_CONN];
+	atorch_data_t last[ATORCH_MAX_CONN];
+	uint64_t mono0 = get_time_us(), real0 = get_time_real_us(), next, now;
+	unsigned have = 0;
+	int i;
+
+	bt_catch_stop();
+	for (i = 0; i < n; i++) {
+		atorch_init(&c[i]);
+		c[i].io->timeout = 3000;
+		fds[i].fd = c[i].io->rx ? c[i].io->rx->pipe[0] : c[i].io->sock;
+		fds[i].events = POLLIN;
+	}
+	next = get_time_us() + tick * 1000;
+	for (;;) {
+		int ret, wait = -1;
+		if (bt_stop) break;
+		if (tick) {
+			now = get_time_us();
+			wait = next > now ? (next - now + 999) / 1000 : 0;
+		}
+		/* frames already taken by the receive threads */
+		for (i = 0; i < n; i++)
+			if (c[i].io->rx && rx_ring_ready(c[i].io->rx)) wait = 0;
+		ret = poll(fds, n, wait);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			PERROR_EXIT(poll);
+		}
+		for (i = 0; i < n; i++) {
+			atorch_data_t x;
+			rx_ring_t *r = c[i].io->rx;
+			if (r) {
+				if (fds[i].revents) rx_ring_drain(r);
+				if (!rx_ring_ready(r)) continue;
+			} else if (!fds[i].revents) continue;
+			ret = atorch_read(&c[i], &x);
+			if (ret < 0) return;
+			atorch_link_check();
+			if (!ret) continue;
+			x.time = real0 + (get_time_us() - mono0);
+			atorch_latest_set(&x);
+			if (!tick) atorch_print(&x, ATORCH_PRINT_TIME | ATORCH_PRINT_PORT);
+			else last[i] = x, have |= 1u << i;
+		}
+		now = get_time_us();
+		if (tick && now >= next) {
+			atorch_print_row(real0 + (now - mono0), last, n, have);
+			next += tick * 1000;
+			if (next <= now) next = now + tick * 1000;
 		}
 	}
 }
@@ -0,0 +1,180 @@
+/*
+ * Microbenchmarks for the per-frame code paths, on synthetic frames.
+ */
+
+#define BENCH_FRAMES 1024
+#define BENCH_STRIDE 64
+#define BENCH_RUNS 15
+
+typedef struct {
+	uint8_t data[BENCH_FRAMES][BENCH_STRIDE];
+	int len[BENCH_FRAMES];
+	FILE *null;
+} bench_t;
+
+typedef unsigned (*bench_fn_t)(bench_t *b, int i);
+
+static unsigned bench_rand(unsigned *seed) {
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 16;
+}
+
+static unsigned bench_crc8(bench_t *b, int i) {
+	return tjd_crc8(b->data[i], b->len[i]);
+}
+
+static unsigned bench_crc8_ref(bench_t *b, int i) {
+	return crc8_ref(b->data[i], b->len[i], 0);
+}
+
+static unsigned bench_sum8(bench_t *b, int i) {
+	return sum8(b->data[i] + 3, b->len[i] - 4);
+}
+
+static unsigned bench_sum8_ref(bench_t *b, int i) {
+	return sum8_ref(b->data[i] + 3, b->len[i] - 4);
+}
+
+static unsigned bench_tjd(bench_t *b, int i) {
+	return tjd_check(b->data[i], b->len[i]);
+}
+
+static unsigned bench_moyoung(bench_t *b, int i) {
+	return moyoung_check(b->data[i], b->len[i]);
+}
+
+static unsigned bench_atorch(bench_t *b, int i) {
+	const uint8_t *buf = b->data[i];
+	atorch_data_t x;
+	if (buf[35] != atorch_checksum(buf + 3, 36 - 4)) return 0;
+	atorch_decode(buf, &x);
+	return x.vol + x.cur + x.cap + x.ene;
+}
+
+static unsigned bench_print_mem(bench_t *b, int i) {
+	print_mem(b->null, b->data[i], b->len[i]);
+	return 0;
+}
+
+static unsigned bench_print_esc(bench_t *b, int i) {
+	print_esc_str(b->null, b->data[i], b->len[i]);
+	return 0;
+}
+
+static int bench_enum_cb(void *data, const uint8_t *buf, int n) {
+	*(unsigned*)data += READ16_LE(buf + n - 2);
+	return 0;
+}
+
+static unsigned bench_enum(bench_t *b, int i) {
+	unsigned sum = 0; int start = 1;
+	enum_handles_parse(b->data[i], b->len[i], 0x08,
+			ENUM_CHARS, &start, 0xffff, &bench_enum_cb, &sum);
+	return sum;
+}
+
+static void bench_gen(bench_t *b, const char *name, unsigned seed) {
+	int i, j, n;
+	for (i = 0; i < BENCH_FRAMES; i++) {
+		uint8_t *p = b->data[i];
+		for (j = 0; j < BENCH_STRIDE; j++) p[j] = bench_rand(&seed);
+		if (!strcmp(name, "tjd") || !strncmp(name, "crc8", 4)) {
+			n = 6 + bench_rand(&seed) % 15;
+			p[0] = 0x1b;
+			WRITE16_LE(p + 1, tjd_handle[1]);
+			p[3] = 0x5a; p[4] = n - 3;
+			p[n - 1] = tjd_crc8(p + 3, n - 4);
+		} else if (!strcmp(name, "moyoung")) {
+			n = 7 + bench_rand(&seed) % 17;
+			p[0] = 0x1b;
+			WRITE16_LE(p + 1, moyoung_handle[1]);
+			p[3] = 0xfe; p[4] = 0xea; p[5] = 0x10; p[6] = n - 3;
+		} else if (!strcmp(name, "atorch") || !strncmp(name, "sum8", 4)) {
+			static const uint8_t hdr[] = { 0xff,0x55,0x01,0x03 };
+			n = 36;
+			memcpy(p, hdr, 4);
+			p[35] = atorch_checksum(p + 3, 36 - 4);
+		} else if (!strcmp(name, "enum")) {
+			/* Read By Type Response, three characteristics */
+			n = 2 + 3 * 7;
+			p[0] = 0x09; p[1] = 7;
+			for (j = 0; j < 3; j++)
+				WRITE16_LE(p + 2 + j * 7, 1 + i * 3 + j);
+		} else {
+			n = 1 + bench_rand(&seed) % 20;
+		}
+		b->len[i] = n;
+	}
+}
+
+static double bench_time(bench_t *b, bench_fn_t fn, long iter) {
+	volatile unsigned sink;
+	unsigned sum = 0;
+	struct timespec t0, t1;
+	long k;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (k = 0; k < iter; k++)
+		sum += fn(b, k & (BENCH_FRAMES - 1));
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sink = sum; (void)sink;
+	return (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+}
+
+static int bench_cmp(const void *a, const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void bench_run(bench_t *b, const char *name, bench_fn_t fn, int ms) {
+	double t, res[BENCH_RUNS], med, dev[BENCH_RUNS], bytes = 0;
+	long iter = BENCH_FRAMES;
+	int i;
+
+	bench_gen(b, name, 1);
+	for (i = 0; i < BENCH_FRAMES; i++) bytes += b->len[i];
+	bytes /= BENCH_FRAMES;
+
+	/* calibrate the run length */
+	while ((t = bench_time(b, fn, iter)) < ms * 1e6 / BENCH_RUNS && iter < 1l << 40)
+		iter *= 2;
+	for (i = 0; i < BENCH_RUNS; i++)
+		res[i] = bench_time(b, fn, iter) / iter;
+	qsort(res, BENCH_RUNS, sizeof(*res), bench_cmp);
+	med = res[BENCH_RUNS / 2];
+	/* median absolute deviation */
+	for (i = 0; i < BENCH_RUNS; i++)
+		dev[i] = res[i] > med ? res[i] - med : med - res[i];
+	qsort(dev, BENCH_RUNS, sizeof(*dev), bench_cmp);
+	printf("%-10s %5.1f B %9.2f ns/frame (min %.2f, mad %.1f%%) %9.1f MB/s\n",
+			name, bytes, med, res[0], dev[BENCH_RUNS / 2] * 100 / med,
+			bytes * 1e3 / med);
+}
+
+static void bench_main(int argc, char **argv) {
+	static const struct {
+		const char *name; bench_fn_t fn;
+	} list[] = {
+		{ "crc8_ref", bench_crc8_ref },
+		{ "crc8", bench_crc8 },
+		{ "sum8_ref", bench_sum8_ref },
+		{ "sum8", bench_sum8 },
+		{ "tjd", bench_tjd },
+		{ "moyoung", bench_moyoung },
+		{ "atorch", bench_atorch },
+		{ "print_mem", bench_print_mem },
+		{ "print_esc", bench_print_esc },
+		{ "enum", bench_enum },
+	};
+	bench_t *b;
+	int i, ms = 300;
+
+	if (argc > 1) ms = atoi(argv[1]);
+	if (ms <= 0) ERR_EXIT("bad command\n");
+	if (!(b = malloc(sizeof(*b)))) ERR_EXIT("malloc failed\n");
+	if (!(b->null = fopen("/dev/null", "w"))) PERROR_EXIT(fopen);
+	moyoung_handle[1] = 0x34;
+	for (i = 0; i < (int)(sizeof(list) / sizeof(*list)); i++)
+		bench_run(b, list[i].name, list[i].fn, ms);
+	fclose(b->null);
+	free(b);
+}
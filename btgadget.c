@@ -18,15 +18,29 @@
 #define _XOPEN_SOURCE 500
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <math.h>
 
 #include <errno.h>
 #include <unistd.h>
 #include <poll.h>
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #if 1
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/l2cap.h>
@@ -48,19 +62,36 @@ static void print_esc_str(FILE *f, const uint8_t *buf, size_t len) {
 	}
 }
 
+#define MEM_LINE_MAX (16 * 3 + 2 + 16 + 2)
+
+/* formats up to 16 bytes as a hex dump line, returns the length */
+static int format_mem_line(char *d, const uint8_t *buf, int n) {
+	static const char hex[] = "0123456789abcdef";
+	char *p = d;
+	int a, j;
+	for (j = 0; j < n; j++, p += 3) {
+		a = buf[j];
+		p[0] = hex[a >> 4];
+		p[1] = hex[a & 15];
+		p[2] = ' ';
+	}
+	for (; j < 16; j++, p += 3) p[0] = p[1] = p[2] = ' ';
+	*p++ = ' '; *p++ = '|';
+	for (j = 0; j < n; j++) {
+		a = buf[j];
+		*p++ = a > 0x20 && a < 0x7f ? a : '.';
+	}
+	*p++ = '|'; *p++ = '\n';
+	return p - d;
+}
+
 static void print_mem(FILE *f, const uint8_t *buf, size_t len) {
-	size_t i; int a, j, n;
+	char line[MEM_LINE_MAX];
+	size_t i; int n;
 	for (i = 0; i < len; i += 16) {
 		n = len - i;
 		if (n > 16) n = 16;
-		for (j = 0; j < n; j++) fprintf(f, "%02x ", buf[i + j]);
-		for (; j < 16; j++) fprintf(f, "   ");
-		fprintf(f, " |");
-		for (j = 0; j < n; j++) {
-			a = buf[i + j];
-			fprintf(f, "%c", a > 0x20 && a < 0x7f ? a : '.');
-		}
-		fprintf(f, "|\n");
+		fwrite(line, 1, format_mem_line(line, buf + i, n), f);
 	}
 }
 
@@ -81,6 +112,24 @@ static uint8_t* loadfile(const char *fn, size_t *num, size_t lim) {
 	return buf;
 }
 
+static uint64_t get_time_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t get_time_real_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t get_time_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 #define L2CAP_ADDR \
 	struct sockaddr_l2 addr = { 0 }; \
 	addr.l2_family = AF_BLUETOOTH; \
@@ -173,15 +222,44 @@ static int rfcomm_connect(int sock, const bdaddr_t *bdaddr,
 	((uint8_t*)(p))[2] << 8 | \
 	((uint8_t*)(p))[3])
 
+#include "stats.h"
+
 #define IO_BUFSIZE 256
 
+typedef struct rx_ring rx_ring_t;
+
 typedef struct {
 	int sock, verbose, timeout, type;
+	rx_ring_t *rx; // receive thread
 	uint8_t buf[IO_BUFSIZE];
 } btio_t;
 
+#include "trace.h"
+#include "out.h"
+#include "rxring.h"
+
 static int bt_send(btio_t *io, const void *data, int len);
 
+static volatile sig_atomic_t bt_stop;
+
+static void bt_stop_sig(int sig) {
+	(void)sig;
+	bt_stop = 1;
+}
+
+/*
+ * SIGINT and SIGTERM make bt_recv return as on timeout,
+ * so that the loops end normally and the atexit handlers run.
+ */
+static void bt_catch_stop(void) {
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = bt_stop_sig;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
 #define BT_FILTER_NOTIFY_NONE -1
 #define BT_FILTER_NOTIFY_ALL -2
 static int bt_filter_notify = BT_FILTER_NOTIFY_NONE;
@@ -189,22 +267,52 @@ static int bt_filter_notify = BT_FILTER_NOTIFY_NONE;
 static int bt_recv(btio_t *io) {
 	int ret, len;
 loop:
-	if (io->timeout >= 0) {
+	if (bt_stats.dump) {
+		bt_stats.dump = 0;
+		bt_stats_print();
+	}
+	if (io->timeout >= 0 || io->rx || bt_out.pos) {
+		/* buffered output is flushed only before waiting */
+		int timeout = bt_out.pos ? 0 : io->timeout;
 		struct pollfd fds = { 0 };
 		fds.fd = io->sock;
 		fds.events = POLLIN;
-		ret = poll(&fds, 1, io->timeout);
-		if (ret < 0) PERROR_EXIT(poll);
+		ret = io->rx ? rx_ring_poll(io->rx, &fds.revents, timeout) :
+				poll(&fds, 1, timeout);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				if (bt_stop) return 0;
+				goto loop;
+			}
+			PERROR_EXIT(poll);
+		}
 		if (fds.revents & POLLHUP)
 			ERR_EXIT("connection closed\n");
-		if (!ret) return 0;
+		if (!ret) {
+			if (bt_out.pos) {
+				out_flush();
+				goto loop;
+			}
+			COUNTER_ADD(timeouts, 1);
+			if (bt_stats.enabled) bt_stats_recv(io->buf, 0);
+			return 0;
+		}
 	}
-	len = read(io->sock, io->buf, sizeof(io->buf));
-	if (io->verbose >= 2 && len > 0) {
-		DBG_LOG("recv (%d):\n", len);
-		print_mem(stderr, io->buf, len);
+	if (io->rx) len = rx_ring_pop(io->rx, io->buf);
+	else len = read(io->sock, io->buf, sizeof(io->buf));
+	if (len < 0 && errno == EINTR) goto loop;
+	if (len > 0) {
+		COUNTER_ADD(rx_packets, 1);
+		COUNTER_ADD(rx_bytes, len);
 	}
+	if (io->verbose >= 2 && len > 0)
+		trace_mem(TRACE_RECV, io->buf, len);
 	if (io->type != 0) return len;
+	if (len > 0) {
+		int op = io->buf[0];
+		if (op == 0x1b || op == 0x1d) COUNTER_ADD(notifications, 1);
+		else if (op & 1) COUNTER_ADD(responses, 1);
+	}
 	// handle Exchange MTU Request
 	if (len == 3 && io->buf[0] == 0x02) {
 		// send Error Response
@@ -218,6 +326,7 @@ loop:
 		int handle = READ16_LE(io->buf + 1);
 		if (handle != bt_filter_notify) goto loop;
 	}
+	if (bt_stats.enabled && len > 0) bt_stats_recv(io->buf, len);
 	return len;
 }
 
@@ -227,50 +336,127 @@ static int bt_send(btio_t *io, const void *data, int len) {
 
 	if (!buf) buf = io->buf;
 	if (!len) ERR_EXIT("empty message\n");
-	if (io->verbose >= 2) {
-		DBG_LOG("send (%d):\n", len);
-		print_mem(stderr, buf, len);
-	}
+	if (io->verbose >= 2)
+		trace_mem(TRACE_SEND, buf, len);
+	if (bt_stats.enabled && io->type == 0) bt_stats_send(buf);
+	// commands and confirmations don't have responses
+	if (io->type == 0 && !(buf[0] & 0x41) && buf[0] != 0x1e)
+		COUNTER_ADD(requests, 1);
 
 	ret = write(io->sock, buf, len);
 	if (ret < 0) PERROR_EXIT(write);
+	COUNTER_ADD(tx_packets, 1);
+	COUNTER_ADD(tx_bytes, ret);
 	return ret;
 }
 
-static void bt_write_req(btio_t *io, int handle) {
+/* waits until the link is usable */
+static void wait_connected(btio_t *io) {
+	struct pollfd fds = { 0 };
+	fds.fd = io->sock;
+	fds.events = POLLOUT;
+	if (poll(&fds, 1, -1) < 0) PERROR_EXIT(poll);
+	timing_mark("connect");
+}
+
+static void bt_write_req(btio_t *io, int handle, int value) {
 	io->buf[0] = 0x12;
 	WRITE16_LE(io->buf + 1, handle);
-	io->buf[3] = 1;
-	io->buf[4] = 0;
+	WRITE16_LE(io->buf + 3, value);
 	bt_send(io, NULL, 5);
 	bt_recv(io);
 }
 
+/* UUID as on the air (little endian), 2 or 16 bytes */
+typedef struct {
+	int len;
+	uint8_t b[16];
+} bt_uuid_t;
+
 // 06  01 00  ff ff  00 28  d0 18
 // 07  19 00  20 00
 
-static int bt_get_type_range(btio_t *io, int value, int *end) {
+static int bt_find_service(btio_t *io, const bt_uuid_t *uuid, int *end) {
 	int len, start;
 	io->buf[0] = 0x06;
 	WRITE16_LE(io->buf + 1, 1);
 	WRITE16_LE(io->buf + 3, 0xffff);
 	WRITE16_LE(io->buf + 5, 0x2800);
-	WRITE16_LE(io->buf + 7, value);
-	bt_send(io, NULL, 9);
+	memcpy(io->buf + 7, uuid->b, uuid->len);
+	bt_send(io, NULL, 7 + uuid->len);
 	len = bt_recv(io);
 	if (len != 5 || io->buf[0] != 0x07) {
 		ERR_EXIT("unexpected response\n");
 	}
 	start = READ16_LE(io->buf + 1);
 	*end = READ16_LE(io->buf + 3);
+	timing_mark("service");
 	return start;
 }
 
+static int bt_get_type_range(btio_t *io, int value, int *end) {
+	bt_uuid_t uuid = { 2, { value, value >> 8 } };
+	return bt_find_service(io, &uuid, end);
+}
+
 enum { ENUM_PRIMARY, ENUM_CHARS, ENUM_CHAR_DESC };
 
+typedef int (*enum_cb_t)(void*, const uint8_t*, int);
+
+/*
+ * Parses one response of the discovery request with opcode "req".
+ * Returns 0 to continue, -1 to stop, or the result for the caller.
+ */
+static int enum_handles_parse(const uint8_t *buf, int len, int req,
+		int mode, int *pstart, int end, enum_cb_t cb, void *data) {
+	int i, j, n, start = *pstart;
+	if (len <= 2) {
+		DBG_LOG("unexpected length\n");
+		return -1;
+	}
+	if (buf[0] == 0x01) {
+		if (len != 5 || buf[1] != req || READ16_LE(buf + 2) != start || buf[4] != 0x0a)
+			DBG_LOG("unexpected error response\n");
+		else *pstart = end + 1;
+		return -1;
+	}
+	if (buf[0] != req + 1) {
+		DBG_LOG("unexpected opcode (0x%02x)\n", buf[0]);
+		return -1;
+	}
+	n = buf[1]; j = 0;
+	if (mode == ENUM_PRIMARY) {
+		if (n == 4 + 2 || n == 4 + 16) j = 4;
+	} else if (mode == ENUM_CHARS) {
+		if (n == 5 + 2 || n == 5 + 16) j = 5;
+	} else if (mode == ENUM_CHAR_DESC) {
+		if (n == 1) j = 2, n = 2 + 2;
+		else if (n == 2) j = 2, n = 2 + 16;
+	}
+	if (!j) {
+		DBG_LOG("unexpected type (%u)\n", n);
+		return -1;
+	}
+	if ((len - 2) % n) {
+		DBG_LOG("unexpected remainder\n");
+		return -1;
+	}
+	for (i = 2; i < len; i += n) {
+		int h = READ16_LE(buf + i);
+		if (h < start || h > end) {
+			DBG_LOG("handle out of range\n");
+			return 1;
+		}
+		*pstart = start = h + 1;
+		j = cb(data, buf + i, n);
+		if (j) return j;
+	}
+	return 0;
+}
+
 static int enum_handles(btio_t *io, int start, int end, int mode,
-		int (*cb)(void*, const uint8_t*, int), void *data) {
-	int i, j, len, n;
+		enum_cb_t cb, void *data) {
+	int j, len, n;
 	while (start <= end) {
 		if (mode == ENUM_PRIMARY) {
 			io->buf[0] = 0x10; // Read By Group Type Request
@@ -293,47 +479,9 @@ static int enum_handles(btio_t *io, int start, int end, int mode,
 		j = io->buf[0];
 		bt_send(io, NULL, n);
 		len = bt_recv(io);
-		if (len <= 2) {
-			DBG_LOG("unexpected length\n");
-			break;
-		}
-		if (io->buf[0] == 0x01) {
-			if (len != 5 || io->buf[1] != j || READ16_LE(io->buf + 2) != start || io->buf[4] != 0x0a)
-				DBG_LOG("unexpected error response\n");
-			else start = end + 1;
-			break;
-		}
-		if (io->buf[0] != j + 1) {
-			DBG_LOG("unexpected opcode (0x%02x)\n", io->buf[0]);
-			break;
-		}
-		n = io->buf[1]; j = 0;
-		if (mode == ENUM_PRIMARY) {
-			if (n == 4 + 2 || n == 4 + 16) j = 4;
-		} else if (mode == ENUM_CHARS) {
-			if (n == 5 + 2 || n == 5 + 16) j = 5;
-		} else if (mode == ENUM_CHAR_DESC) {
-			if (n == 1) j = 2, n = 2 + 2;
-			else if (n == 2) j = 2, n = 2 + 16;
-		}
-		if (!j) {
-			DBG_LOG("unexpected type (%u)\n", n);
-			break;
-		}
-		if ((len - 2) % n) {
-			DBG_LOG("unexpected remainder\n");
-			break;
-		}
-		for (i = 2; i < len; i += n) {
-			int h = READ16_LE(io->buf + i);
-			if (h < start || h > end) {
-				DBG_LOG("handle out of range\n");
-				return 1;
-			}
-			start = h + 1;
-			j = cb(data, io->buf + i, n);
-			if (j) return j;
-		}
+		j = enum_handles_parse(io->buf, len, j, mode, &start, end, cb, data);
+		if (j < 0) break;
+		if (j) return j;
 	}
 	return start <= end;
 }
@@ -364,8 +512,12 @@ static int bt_find_char(btio_t *io, int start, int end,
 	memset(dest, -1, n * sizeof(*dest));
 	i = enum_handles(io, start, end, ENUM_CHARS,
 			&bt_find_char_cb, &data);
-	if (i == 2) return n;
+	if (i == 2) {
+		timing_mark("chars");
+		return n;
+	}
 	for (k = i = 0; i < n; i++) k += dest[i] != -1;
+	timing_mark("chars");
 	return k;
 }
 
@@ -391,13 +543,19 @@ static void bt_write_req_desc(btio_t *io, int desc_handle, int end) {
 	if (ret <= end) {
 		ret = bt_find_char_desc(io, ret, ret, 0x2902);
 		if (ret >= 0) {
-			bt_write_req(io, ret);
+			bt_write_req(io, ret, 1);
+			timing_mark("cccd");
 			return;
 		}
 	}
 	ERR_EXIT("can't find char desc\n");
 }
 
+/*
+ * Appends notifications to the value in io->buf up to "n" bytes.
+ * Returns -1 at the end of the stream, or -1 - len when a frame of
+ * "len" bytes doesn't continue the value, the frame is left in io->buf.
+ */
 static int bt_recv_more(btio_t *io, int pos, int n) {
 	uint8_t buf[IO_BUFSIZE];
 	int len, handle = READ16_LE(io->buf + 1);
@@ -407,52 +565,88 @@ static int bt_recv_more(btio_t *io, int pos, int n) {
 	for (; pos < n; pos += len) {
 		len = bt_recv(io);
 		if (len < 3) return -1;
-		if (io->buf[0] != 0x1b) return -1;
-		if (READ16_LE(io->buf + 1) != handle) return -1;
+		if (io->buf[0] != 0x1b || READ16_LE(io->buf + 1) != handle ||
+				n - pos < len - 3)
+			return -1 - len;
 		len -= 3;
-		if (n - pos < len) return -1;
 		memcpy(buf + pos, io->buf + 3, len);
 	}
 	memcpy(io->buf + 3, buf, n);
 	return n;
 }
 
+static int ch2hex(unsigned a) {
+	const char *tab = "abcdef0123456789ABCDEF";
+	const char *p = strchr(tab, a);
+	return p ? (p - tab + 10) & 15 : -1;
+}
+
+/* "180d", "0x180d" or "6e400001-b5a3-f393-e0a9-e50e24dcca9e" */
+static int str2uuid(const char *s, bt_uuid_t *uuid) {
+	int i, h, a;
+	size_t n;
+	if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) s += 2;
+	if ((n = strlen(s)) != 4 && n != 36) return -1;
+	uuid->len = n == 4 ? 2 : 16;
+	for (i = uuid->len; i--;) {
+		if (uuid->len == 16 && (i == 11 || i == 9 || i == 7 || i == 5))
+			if (*s++ != '-') return -1;
+		if ((h = ch2hex(*s++)) < 0 || (a = ch2hex(*s++)) < 0) return -1;
+		uuid->b[i] = h << 4 | a;
+	}
+	if (*s) return -1;
+	/* the Bluetooth base UUID is always sent in the short form */
+	if (uuid->len == 16 && !memcmp(uuid->b, "\xfb\x34\x9b\x5f\x80\x00\x00\x80"
+			"\x00\x10\x00\x00", 12) && !uuid->b[14] && !uuid->b[15])
+		uuid->len = 2, uuid->b[0] = uuid->b[12], uuid->b[1] = uuid->b[13];
+	return 0;
+}
+
+/* "buf" is a 16-bit or 128-bit UUID as on the air */
+static void format_uuid(char *dst, const uint8_t *buf, int len) {
+	if (len == 2)
+		sprintf(dst, "%08x-0000-1000-8000-00805f9b34fb",
+				READ16_LE(buf));
+	else
+		sprintf(dst, "%08x-%04x-%04x-%04x-%04x%08x",
+				READ32_LE(buf + 12), READ16_LE(buf + 10),
+				READ16_LE(buf + 8), READ16_LE(buf + 6),
+				READ16_LE(buf + 4), READ32_LE(buf));
+}
+
 #include "uuid_info.h"
+#include "uuid_db.h"
 
 static int list_handles_cb(void *data, const uint8_t *buf, int n) {
 	int j, mode = (uintptr_t)data & 0xffff;
 	int verbose = (uintptr_t)data >> 16;
 	int h = READ16_LE(buf);
+	char uuid_str[40];
 	if (mode == ENUM_PRIMARY) {
-		DBG_LOG("0x%04x: end = 0x%04x, uuid = ",
-				h, READ16_LE(buf + 2));
+		out_begin("primary", NULL);
+		out_int("handle", "0x%04x: ", h);
+		out_int("end", "end = 0x%04x, ", READ16_LE(buf + 2));
 		j = 4;
 	} else if (mode == ENUM_CHARS) {
-		DBG_LOG("0x%04x: prop = 0x%02x, val = 0x%04x, uuid = ",
-				h, buf[2], READ16_LE(buf + 3));
+		out_begin("char", NULL);
+		out_int("handle", "0x%04x: ", h);
+		out_int("prop", "prop = 0x%02x, ", buf[2]);
+		out_int("val", "val = 0x%04x, ", READ16_LE(buf + 3));
 		j = 5;
 	} else if (mode == ENUM_CHAR_DESC) {
-		DBG_LOG("0x%04x: uuid = ", h);
+		out_begin("desc", NULL);
+		out_int("handle", "0x%04x: ", h);
 		j = 2;
 	} else return -1;
 	buf += j;
-	if (n == j + 2)
-		DBG_LOG("%08x-0000-1000-8000-00805f9b34fb\n",
-				READ16_LE(buf));
-	else
-		DBG_LOG("%08x-%04x-%04x-%04x-%04x%08x\n",
-				READ32_LE(buf + 12), READ16_LE(buf + 10),
-				READ16_LE(buf + 8), READ16_LE(buf + 6),
-				READ16_LE(buf + 4), READ32_LE(buf));
+	format_uuid(uuid_str, buf, n - j);
+	out_str("uuid", "uuid = %s\n", (uint8_t*)uuid_str, strlen(uuid_str));
 
-	if (verbose >= 1 && n == j + 2) {
-		int i, uuid = READ16_LE(buf);
-		for (i = 0; gatt_uuid_info[i].info; i++)
-			if (gatt_uuid_info[i].uuid == uuid) {
-				DBG_LOG("info: %s\n", gatt_uuid_info[i].info);
-				break;
-			}
+	if (verbose >= 1) {
+		const char *s = uuid_name(buf, n - j, &j);
+		if (s) out_str("info", "info: %s\n", (const uint8_t*)s, j);
 	}
+	out_end(NULL);
 	return 0;
 }
 
@@ -470,7 +664,9 @@ static int pnm_next(FILE *f) {
 		if (a == '#') do a = fgetc(f); while (a != '\n' && a != '\r' && a != EOF);
 		if ((unsigned)a - '0' < 10) {
 			if (n < 0) n = 0;
-			if ((n = n * 10 + a - '0') >= 1 << 16) break;
+			a -= '0';
+			if (n > ((1 << 30) - 1 - a) / 10) break;
+			n = n * 10 + a;
 		} else if (a == ' ' || a == '\n' || a == '\r' || a == '\t') {
 			if (n >= 0) return n;
 		} else if (a == EOF) return n;
@@ -479,16 +675,17 @@ static int pnm_next(FILE *f) {
 	return -1;
 }
 
+#include "gatt.h"
+#include "cksum.h"
 #include "tjd.h"
 #include "moyoung.h"
 #include "atorch.h"
+#include "subscribe.h"
+#include "image.h"
 #include "yhk_print.h"
-
-static int ch2hex(unsigned a) {
-	const char *tab = "abcdef0123456789ABCDEF";
-	const char *p = strchr(tab, a);
-	return p ? (p - tab + 10) & 15 : -1;
-}
+#include "sim.h"
+#include "bench.h"
+#include "metrics.h"
 
 static int str2bdaddr(const char *s, bdaddr_t *d) {
 	int i;
@@ -501,16 +698,36 @@ static int str2bdaddr(const char *s, bdaddr_t *d) {
 	return i - 6;
 }
 
+/* ATT connection, or the simulator if "sim" is set */
+static int att_connect(const char *unix_path, int sim,
+		const bdaddr_t *sba, int stype, const bdaddr_t *dba, int dtype) {
+	int sock, ret;
+	if (sim) return sim_connect(unix_path, SOCK_SEQPACKET);
+	sock = socket(AF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+	if (sock < 0) PERROR_EXIT(socket);
+	timing_mark("socket");
+	ret = l2cap_bind(sock, sba, stype, 0, ATT_CID);
+	if (ret) PERROR_EXIT(bind);
+	timing_mark("bind");
+	ret = l2cap_connect(sock, dba, dtype, 0, ATT_CID);
+	if (ret) PERROR_EXIT(connect);
+	return sock;
+}
+
 int main(int argc, char **argv) {
 	const char *src_str = "00:00:00:00:00:00"; // BDADDR_ANY
 	const char *dst_str = NULL;
+	const char *unix_path = NULL;
+	const char *metrics_addr = NULL;
 	bdaddr_t sba, dba;
 	int stype = BDADDR_LE_PUBLIC;
 	int dtype = BDADDR_LE_PUBLIC;
 	int ret;
 	btio_t io_buf, *io = &io_buf;
-	int verbose = 0;
+	int verbose = 0, sim = 0, timing = 0;
+	uint64_t start = get_time_us();
 
+	cksum_init();
 	while (argc > 1) {
 		if (!strcmp(argv[1], "--src")) {
 			if (argc <= 2) ERR_EXIT("bad option\n");
@@ -532,38 +749,154 @@ int main(int argc, char **argv) {
 			if (argc <= 2) ERR_EXIT("bad option\n");
 			verbose = atoi(argv[2]);
 			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--stats")) {
+			bt_stats_init();
+			argc -= 1; argv += 1;
+		} else if (!strcmp(argv[1], "--timing")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			if (!strcmp(argv[2], "text")) timing = 1;
+			else if (!strcmp(argv[2], "json")) timing = 2;
+			else ERR_EXIT("bad option\n");
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--output")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			if (!strcmp(argv[2], "text")) out_init(OUT_TEXT);
+			else if (!strcmp(argv[2], "json")) out_init(OUT_JSON);
+			else if (!strcmp(argv[2], "bin")) out_init(OUT_BIN);
+			else ERR_EXIT("bad option\n");
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--metrics")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			metrics_addr = argv[2];
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--uuid-db")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			uuid_db_load(argv[2]);
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--rx-ring")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			bt_rx_slots = atoi(argv[2]);
+			if (bt_rx_slots <= 0) ERR_EXIT("bad option\n");
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--unix")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			unix_path = argv[2];
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--sim")) {
+			sim = 1;
+			argc -= 1; argv += 1;
+		} else if (!strcmp(argv[1], "--sim-latency")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			sim_conf.latency = atoi(argv[2]);
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--sim-loss")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			sim_conf.loss = atoi(argv[2]);
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--sim-mtu")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			sim_conf.mtu = atoi(argv[2]);
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--sim-atorch")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			sim_conf.atorch = atoi(argv[2]);
+			if (sim_conf.atorch < 1 || sim_conf.atorch > 3) ERR_EXIT("bad option\n");
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--sim-paper")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			sim_conf.paper = atoi(argv[2]);
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--sim-speed")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			sim_conf.speed = atoi(argv[2]);
+			argc -= 2; argv += 2;
+		} else if (!strcmp(argv[1], "--sim-period")) {
+			if (argc <= 2) ERR_EXIT("bad option\n");
+			sim_conf.period = atoi(argv[2]);
+			if (sim_conf.period <= 0) ERR_EXIT("bad option\n");
+			argc -= 2; argv += 2;
 		} else if (argv[1][0] == '-') {
 			ERR_EXIT("unknown option\n");
 		} else break;
 	}
 
+	if (argc > 1 && !strcmp(argv[1], "simserver")) {
+		if (argc <= 3) ERR_EXIT("bad command\n");
+		sim_server(argv[2], argv[3]);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "cksumtest")) {
+		return (cksum_test() | dither_test() | uuid_test()) ? 1 : 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "bench")) {
+		bench_main(argc - 1, argv + 1);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "recdump")) {
+		double from = 0, to = 1e12;
+		if (argc <= 2) ERR_EXIT("bad command\n");
+		if (argc > 3) from = strtod(argv[3], NULL);
+		if (argc > 4) to = strtod(argv[4], NULL);
+		ring_dump(argv[2], from, to);
+		return 0;
+	}
+
+	if (argc > 1 && (!strcmp(argv[1], "arcdump") || !strcmp(argv[1], "arcstat"))) {
+		double from = 0, to = 1e12;
+		if (argc <= 2) ERR_EXIT("bad command\n");
+		if (argc > 3) from = strtod(argv[3], NULL);
+		if (argc > 4) to = strtod(argv[4], NULL);
+		if (argv[1][3] == 'd') arc_dump(argv[2], from, to);
+		else arc_stat(argv[2], from, to);
+		return 0;
+	}
+
+	if (argc > 1 && !strcmp(argv[1], "shmread")) {
+		if (argc <= 2) ERR_EXIT("bad command\n");
+		shm_feed_dump(argv[2], argc > 3 ? atoi(argv[3]) : 1);
+		return 0;
+	}
+
+	if (unix_path) sim = 1;
 	if (str2bdaddr(src_str, &sba))
 		ERR_EXIT("malformed src addr\n");
-	if (!dst_str) ERR_EXIT("dst addr required\n");
-	if (str2bdaddr(dst_str, &dba))
+	if (!dst_str && !sim) ERR_EXIT("dst addr required\n");
+	if (dst_str && str2bdaddr(dst_str, &dba))
 		ERR_EXIT("malformed dst addr\n");
 
 	io->timeout = 1000;
 	io->verbose = verbose;
+	io->rx = NULL;
+	if (metrics_addr) metrics_init(metrics_addr);
+	if (timing) {
+		timing_init(timing, start);
+		timing_mark("args");
+	}
 
 	if (argc > 1 && !strcmp(argv[1], "yhk_print")) {
 		argc -= 1; argv += 1;
 		io->type = 2;
-		io->sock = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
-		if (io->sock < 0) PERROR_EXIT(socket);
-		ret = rfcomm_connect(io->sock, &dba, 2);
-		if (ret) PERROR_EXIT(connect);
+		if (sim) {
+			io->sock = sim_connect(unix_path, SOCK_STREAM);
+		} else {
+			io->sock = socket(AF_BLUETOOTH, SOCK_STREAM, BTPROTO_RFCOMM);
+			if (io->sock < 0) PERROR_EXIT(socket);
+			timing_mark("socket");
+			ret = rfcomm_connect(io->sock, &dba, 2);
+			if (ret) PERROR_EXIT(connect);
+		}
+		if (timing) wait_connected(io);
 		yhk_print_main(io, argc, argv);
 		goto end;
 	}
 
 	io->type = 0;
-	io->sock = socket(AF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
-	if (io->sock < 0) PERROR_EXIT(socket);
-	ret = l2cap_bind(io->sock, &sba, stype, 0, ATT_CID);
-	if (ret) PERROR_EXIT(bind);
-	ret = l2cap_connect(io->sock, &dba, dtype, 0, ATT_CID);
-	if (ret) PERROR_EXIT(connect);
+	io->sock = att_connect(unix_path, sim, &sba, stype, &dba, dtype);
+	if (timing) wait_connected(io);
+	if (bt_rx_slots) rx_ring_start(io, bt_rx_slots);
 
 	while (argc > 1) {
 		if (!strcmp(argv[1], "verbose")) {
@@ -593,10 +926,87 @@ int main(int argc, char **argv) {
 			moyoung_main(io, argc, argv);
 			break;
 
+		} else if (!strcmp(argv[1], "subscribe")) {
+			argc -= 1; argv += 1;
+			subscribe_main(io, argc, argv);
+			break;
+
 		} else if (!strcmp(argv[1], "atorch")) {
 			atorch_loop(io);
 			argc -= 1; argv += 1;
 
+		} else if (!strcmp(argv[1], "multi")) {
+			atorch_conn_t conn[ATORCH_MAX_CONN];
+			btio_t *ios;
+			bdaddr_t addr;
+			int n = 1, tick;
+			if (argc <= 2) ERR_EXIT("bad command\n");
+			tick = atoi(argv[2]);
+			argc -= 2; argv += 2;
+			ios = malloc(sizeof(*ios) * (ATORCH_MAX_CONN - 1));
+			if (!ios) ERR_EXIT("malloc failed\n");
+			conn[0].io = io;
+			conn[0].port = 0;
+			for (; argc > 1 && !str2bdaddr(argv[1], &addr); argc--, argv++) {
+				btio_t *io2;
+				if (n == ATORCH_MAX_CONN) ERR_EXIT("too many testers\n");
+				io2 = &ios[n - 1];
+				*io2 = *io;
+				io2->sock = att_connect(unix_path, sim, &sba, stype, &addr, dtype);
+				if (io->rx) rx_ring_start(io2, bt_rx_slots);
+				conn[n].io = io2;
+				conn[n].port = n;
+				n++;
+			}
+			atorch_multi(conn, n, tick);
+			for (n--; n > 0; n--) {
+				rx_ring_stop(&ios[n - 1]);
+				close(ios[n - 1].sock);
+			}
+			free(ios);
+
+		} else if (!strcmp(argv[1], "linkstats")) {
+			if (argc <= 2) ERR_EXIT("bad command\n");
+			atorch_link_init(strtod(argv[2], NULL));
+			argc -= 2; argv += 2;
+
+		} else if (!strcmp(argv[1], "record")) {
+			if (argc <= 3) ERR_EXIT("bad command\n");
+			ring_close(&atorch_ring);
+			ring_open(&atorch_ring, argv[2], strtoull(argv[3], NULL, 0), 1);
+			argc -= 3; argv += 3;
+
+		} else if (!strcmp(argv[1], "archive")) {
+			if (argc <= 2) ERR_EXIT("bad command\n");
+			arc_open(argv[2]);
+			argc -= 2; argv += 2;
+
+		} else if (!strcmp(argv[1], "publish")) {
+			if (argc <= 2) ERR_EXIT("bad command\n");
+			if (atorch_shm) ERR_EXIT("feed already open\n");
+			atorch_shm = shm_feed_open(argv[2], 1);
+			argc -= 2; argv += 2;
+
+		} else if (!strcmp(argv[1], "summary")) {
+			const char *win = "1,60,3600";
+			if (argc <= 2) ERR_EXIT("bad command\n");
+			if (argc > 3 && (unsigned)(argv[3][0] - '0') < 10) {
+				win = argv[3];
+				argc--; argv++;
+			}
+			sum_init(strtod(argv[2], NULL), win);
+			argc -= 2; argv += 2;
+
+		} else if (!strcmp(argv[1], "trigger")) {
+			if (argc <= 3) ERR_EXIT("bad command\n");
+			trig_add(argv[2], argv[3]);
+			argc -= 3; argv += 3;
+
+		} else if (!strcmp(argv[1], "read") || !strcmp(argv[1], "write") ||
+				!strcmp(argv[1], "writecmd")) {
+			int n = gatt_main(io, argc, argv);
+			argc -= n; argv += n;
+
 		} else if (!strcmp(argv[1], "batlevel")) {
 			int len;
 			io->buf[0] = 0x08; // Read By Type Request
@@ -608,7 +1018,9 @@ int main(int argc, char **argv) {
 			if (len == 5 && io->buf[0] == 0x09 && io->buf[1] == 3) {
 				if (io->verbose >= 1)
 					DBG_LOG("Handle = 0x%04x (Battery Level)\n", READ16_LE(io->buf + 2));
-				DBG_LOG("Battery Level = %u%%\n", io->buf[4]);
+				out_begin("battery", NULL);
+				out_int("level", "Battery Level = %u%%\n", io->buf[4]);
+				out_end(NULL);
 			}
 			argc -= 1; argv += 1;
 
@@ -622,6 +1034,9 @@ int main(int argc, char **argv) {
 		}
 	}
 end:
+	timing_mark("commands");
+	rx_ring_stop(io);
 	close(io->sock);
+	timing_mark("teardown");
 }
 
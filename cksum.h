@@ -0,0 +1,153 @@
+/*
+ * Frame checksums: CRC-8 (poly 0x8c, reflected) from a 256-entry table
+ * and byte sums with SSE2/AVX2 kernels picked by the CPU features.
+ * The bitwise and scalar versions are the references for the self-test.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+static uint8_t crc8_table[256];
+
+static unsigned crc8_ref(const uint8_t *s, unsigned n, unsigned c) {
+	unsigned j;
+	while (n--) {
+		c ^= *s++;
+		for (j = 0; j < 8; j++)
+			c = c >> 1 ^ ((0u - (c & 1)) & 0x8c);
+	}
+	return c;
+}
+
+static unsigned crc8_tab(const uint8_t *s, unsigned n, unsigned c) {
+	while (n--) c = crc8_table[c ^ *s++];
+	return c;
+}
+
+static unsigned sum8_ref(const uint8_t *s, unsigned n) {
+	unsigned c = 0;
+	while (n--) c += *s++;
+	return c;
+}
+
+#ifdef CKSUM_X86
+__attribute__((target("sse2")))
+static unsigned sum8_sse2(const uint8_t *s, unsigned n) {
+	__m128i acc = _mm_setzero_si128(), z = acc;
+	unsigned c;
+	for (; n >= 16; n -= 16, s += 16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)s), z));
+	c = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+	while (n--) c += *s++;
+	return c;
+}
+
+__attribute__((target("avx2")))
+static unsigned sum8_avx2(const uint8_t *s, unsigned n) {
+	__m256i acc = _mm256_setzero_si256(), z = acc;
+	__m128i a;
+	unsigned c;
+	for (; n >= 32; n -= 32, s += 32)
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)s), z));
+	a = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	if (n >= 16) {
+		a = _mm_add_epi64(a, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)s), _mm_setzero_si128()));
+		n -= 16; s += 16;
+	}
+	c = _mm_cvtsi128_si32(a) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(a, a));
+	while (n--) c += *s++;
+	return c;
+}
+#endif
+
+typedef unsigned (*sum8_fn_t)(const uint8_t*, unsigned);
+
+static const struct {
+	const char *name; sum8_fn_t fn;
+} sum8_impl[] = {
+	{ "ref", sum8_ref },
+#ifdef CKSUM_X86
+	{ "sse2", sum8_sse2 },
+	{ "avx2", sum8_avx2 },
+#endif
+};
+
+#define SUM8_NIMPL (int)(sizeof(sum8_impl) / sizeof(*sum8_impl))
+
+static sum8_fn_t sum8 = sum8_ref;
+
+static int sum8_supported(int i) {
+#ifdef CKSUM_X86
+	if (sum8_impl[i].fn == sum8_sse2) return __builtin_cpu_supports("sse2");
+	if (sum8_impl[i].fn == sum8_avx2) return __builtin_cpu_supports("avx2");
+#endif
+	return i == 0;
+}
+
+static void cksum_init(void) {
+	int i;
+	for (i = 0; i < 256; i++) {
+		uint8_t b = i;
+		crc8_table[i] = crc8_ref(&b, 1, 0);
+	}
+#ifdef CKSUM_X86
+	__builtin_cpu_init();
+#endif
+	/* the last supported is the widest */
+	for (i = 0; i < SUM8_NIMPL; i++)
+		if (sum8_supported(i)) sum8 = sum8_impl[i].fn;
+}
+
+/*
+ * Compares the kernels with the references: the CRC for every state and
+ * byte, then both on random data of every length up to CKSUM_TEST_LEN at
+ * every alignment up to 32, including all 0xff (the largest sums).
+ */
+#define CKSUM_TEST_LEN 300
+
+static int cksum_test(void) {
+	uint8_t *buf = malloc(CKSUM_TEST_LEN + 32);
+	unsigned seed = 1, c, n, off, fill;
+	int i, err = 0, fail;
+	if (!buf) ERR_EXIT("malloc failed\n");
+
+	for (c = 0; c < 256; c++)
+		for (i = 0; i < 256; i++) {
+			uint8_t b = i;
+			if (crc8_tab(&b, 1, c) != crc8_ref(&b, 1, c)) err++;
+		}
+	for (fill = 0; fill < 2; fill++) {
+		for (i = 0; i < CKSUM_TEST_LEN + 32; i++) {
+			seed = seed * 1103515245 + 12345;
+			buf[i] = fill ? 0xff : seed >> 16;
+		}
+		for (off = 0; off < 32; off++)
+			for (n = 0; n <= CKSUM_TEST_LEN; n++)
+				if (crc8_tab(buf + off, n, 0) != crc8_ref(buf + off, n, 0)) err++;
+	}
+	printf("%-10s %s\n", "crc8", err ? "FAILED" : "ok");
+	fail = err;
+
+	for (i = 1; i < SUM8_NIMPL; i++) {
+		if (!sum8_supported(i)) {
+			printf("sum8_%-5s unsupported\n", sum8_impl[i].name);
+			continue;
+		}
+		err = 0;
+		for (fill = 0; fill < 2; fill++) {
+			for (n = 0; n < CKSUM_TEST_LEN + 32; n++) {
+				seed = seed * 1103515245 + 12345;
+				buf[n] = fill ? 0xff : seed >> 16;
+			}
+			for (off = 0; off < 32; off++)
+				for (n = 0; n <= CKSUM_TEST_LEN; n++)
+					if (sum8_impl[i].fn(buf + off, n) != sum8_ref(buf + off, n)) err++;
+		}
+		printf("sum8_%-5s %s\n", sum8_impl[i].name, err ? "FAILED" : "ok");
+		fail |= err;
+	}
+	free(buf);
+	return fail;
+}
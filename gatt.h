@@ -0,0 +1,197 @@
+/*
+ * Reads and writes of characteristics by UUID. A readable value is
+ * resolved and read with one Read By Type request, the handles are
+ * cached for the rest of the session.
+ */
+
+#define GATT_MTU 23 // the default, never exchanged
+#define GATT_CACHE 16
+#define GATT_MAXLEN 512
+
+static struct {
+	int n;
+	struct { bt_uuid_t uuid; int handle; } e[GATT_CACHE];
+} gatt_cache;
+
+static int gatt_cache_find(const bt_uuid_t *uuid) {
+	int i;
+	for (i = 0; i < gatt_cache.n; i++)
+		if (gatt_cache.e[i].uuid.len == uuid->len &&
+				!memcmp(gatt_cache.e[i].uuid.b, uuid->b, uuid->len))
+			return gatt_cache.e[i].handle;
+	return -1;
+}
+
+static void gatt_cache_add(const bt_uuid_t *uuid, int handle) {
+	int i = gatt_cache.n;
+	if (i == GATT_CACHE) i = GATT_CACHE - 1;
+	else gatt_cache.n++;
+	gatt_cache.e[i].uuid = *uuid;
+	gatt_cache.e[i].handle = handle;
+}
+
+/* sends the request in io->buf, skips notifications while waiting */
+static int gatt_request(btio_t *io, int len) {
+	bt_send(io, NULL, len);
+	for (;;) {
+		len = bt_recv(io);
+		if (len <= 0) ERR_EXIT("no response\n");
+		if (io->buf[0] == 0x1d) bt_send(io, "\x1e", 1);
+		else if (io->buf[0] != 0x1b) return len;
+	}
+}
+
+static int gatt_read_type(btio_t *io, const bt_uuid_t *uuid) {
+	io->buf[0] = 0x08; // Read By Type Request
+	WRITE16_LE(io->buf + 1, 1);
+	WRITE16_LE(io->buf + 3, 0xffff);
+	memcpy(io->buf + 5, uuid->b, uuid->len);
+	return gatt_request(io, 5 + uuid->len);
+}
+
+static void gatt_error(const uint8_t *buf, int len) {
+	if (len == 5 && buf[0] == 0x01)
+		ERR_EXIT("error response 0x%02x (handle 0x%04x)\n", buf[4], READ16_LE(buf + 2));
+	ERR_EXIT("unexpected response\n");
+}
+
+/* reads the rest of a long value with Read Blob requests */
+static int gatt_read_blob(btio_t *io, int handle, uint8_t *dst, int n, int max) {
+	while (n < max) {
+		int len;
+		io->buf[0] = 0x0c; // Read Blob Request
+		WRITE16_LE(io->buf + 1, handle);
+		WRITE16_LE(io->buf + 3, n);
+		len = gatt_request(io, 5);
+		// not a long attribute after all
+		if (io->buf[0] == 0x01 && len == 5 && io->buf[4] == 0x0b) break;
+		if (io->buf[0] != 0x0d) gatt_error(io->buf, len);
+		len--;
+		if (len > max - n) len = max - n;
+		memcpy(dst + n, io->buf + 1, len);
+		n += len;
+		if (len < GATT_MTU - 1) break;
+	}
+	return n;
+}
+
+static int gatt_read(btio_t *io, const bt_uuid_t *uuid, uint8_t *dst, int max) {
+	int len, n, handle = gatt_cache_find(uuid);
+	if (handle < 0) {
+		len = gatt_read_type(io, uuid);
+		if (io->buf[0] != 0x09 || len < 4 || io->buf[1] < 2 || io->buf[1] + 2 > len)
+			gatt_error(io->buf, len);
+		handle = READ16_LE(io->buf + 2);
+		gatt_cache_add(uuid, handle);
+		n = io->buf[1] - 2;
+		if (n > max) n = max;
+		memcpy(dst, io->buf + 4, n);
+		// the value may be truncated to fit the response
+		if (len < GATT_MTU) return n;
+	} else {
+		io->buf[0] = 0x0a; // Read Request
+		WRITE16_LE(io->buf + 1, handle);
+		len = gatt_request(io, 3);
+		if (io->buf[0] != 0x0b) gatt_error(io->buf, len);
+		n = len - 1;
+		if (n > max) n = max;
+		memcpy(dst, io->buf + 1, n);
+		if (len < GATT_MTU) return n;
+	}
+	return gatt_read_blob(io, handle, dst, n, max);
+}
+
+struct gatt_find_data {
+	const bt_uuid_t *uuid; int handle;
+};
+
+static int gatt_find_cb(void *data, const uint8_t *buf, int n) {
+	struct gatt_find_data *x = data;
+	if (x->uuid->len != n - 5 || memcmp(x->uuid->b, buf + 5, n - 5)) return 0;
+	x->handle = READ16_LE(buf + 3);
+	return 1;
+}
+
+/* permission and security errors point at the attribute, other
+ * errors only repeat the start of the requested range */
+static int gatt_err_has_handle(int code) {
+	return code == 0x02 || code == 0x05 || code == 0x08 ||
+			code == 0x0c || code == 0x0f;
+}
+
+static int gatt_resolve(btio_t *io, const bt_uuid_t *uuid) {
+	struct gatt_find_data data = { uuid, -1 };
+	int len, handle = gatt_cache_find(uuid);
+	if (handle >= 0) return handle;
+	len = gatt_read_type(io, uuid);
+	if (io->buf[0] == 0x09 && len >= 4) {
+		handle = READ16_LE(io->buf + 2);
+	} else if (io->buf[0] == 0x01 && len == 5 && gatt_err_has_handle(io->buf[4])) {
+		/* not readable, the error has the handle */
+		handle = READ16_LE(io->buf + 2);
+	} else {
+		/* a server may not report the handle, search the declarations */
+		enum_handles(io, 1, 0xffff, ENUM_CHARS, &gatt_find_cb, &data);
+		handle = data.handle;
+	}
+	if (handle <= 0) ERR_EXIT("can't find char handle\n");
+	gatt_cache_add(uuid, handle);
+	return handle;
+}
+
+/* pairs of hex digits, optionally separated by ':', -1 on odd length */
+static int str2hex(const char *s, uint8_t *dst, int max) {
+	int n = 0, h, a;
+	while (*s) {
+		if (n == max || !s[1]) return -1;
+		if ((h = ch2hex(*s++)) < 0 || (a = ch2hex(*s++)) < 0) return -1;
+		dst[n++] = h << 4 | a;
+		if (*s == ':') s++;
+	}
+	return n;
+}
+
+static void gatt_print(const char *type, const char *name, const uint8_t *buf, int len) {
+	out_begin(type, NULL);
+	out_str("uuid", "%s:", (const uint8_t*)name, strlen(name));
+	out_hex("data", " %s\n", buf, len);
+	out_end(NULL);
+}
+
+/* returns the number of arguments used */
+static int gatt_main(btio_t *io, int argc, char **argv) {
+	uint8_t buf[GATT_MAXLEN];
+	bt_uuid_t uuid;
+	char name[40];
+	int handle, len, op;
+	if (argc <= 2 || str2uuid(argv[2], &uuid)) ERR_EXIT("bad command\n");
+	if (uuid.len == 2) sprintf(name, "%04x", READ16_LE(uuid.b));
+	else format_uuid(name, uuid.b, 16);
+
+	if (!strcmp(argv[1], "read")) {
+		len = gatt_read(io, &uuid, buf, sizeof(buf));
+		if (io->verbose >= 1)
+			DBG_LOG("%s: handle = 0x%04x\n", name, gatt_cache_find(&uuid));
+		gatt_print("read", name, buf, len);
+		return 2;
+	}
+
+	if (argc <= 3) ERR_EXIT("bad command\n");
+	op = !strcmp(argv[1], "write") ? 0x12 : 0x52;
+	if ((len = str2hex(argv[3], io->buf + 3, GATT_MTU - 3)) < 0)
+		ERR_EXIT("bad hex string\n");
+	memcpy(buf, io->buf + 3, len);
+	handle = gatt_resolve(io, &uuid);
+	if (io->verbose >= 1)
+		DBG_LOG("%s: handle = 0x%04x\n", name, handle);
+	io->buf[0] = op;
+	WRITE16_LE(io->buf + 1, handle);
+	memcpy(io->buf + 3, buf, len);
+	if (op == 0x52) {
+		bt_send(io, NULL, 3 + len);
+	} else {
+		len = gatt_request(io, 3 + len);
+		if (io->buf[0] != 0x13) gatt_error(io->buf, len);
+	}
+	return 3;
+}
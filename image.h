@@ -0,0 +1,251 @@
+/*
+ * Images for printing, read row by row: P4 bitmaps of the printer
+ * width as is, P5/P6 (8 or 16 bits) scaled to the printer width by
+ * box filtering and dithered to 1 bit (Floyd-Steinberg or 8x8 ordered).
+ * Only a few rows are kept in memory, so the length is not limited.
+ */
+
+enum { DITHER_FS, DITHER_ORDERED };
+
+typedef struct {
+	FILE *f;
+	int type, dither, chan, bytes; // bytes per sample
+	unsigned w, h, maxval;
+	unsigned width, height; // output
+	unsigned y, next; // output row, next input row
+	uint8_t *in, *gray; // input row, output row in gray
+	uint32_t *acc; // sums of input rows
+	uint16_t *row; // input row in gray, scaled to 0..255 * 256
+	unsigned *xmap; // input range of each output column
+	int *err; // Floyd-Steinberg errors, 2 rows
+	uint8_t *thr; // ordered dither thresholds, 8 rows
+} pnm_img_t;
+
+static const uint8_t dither_bayer8[8][8] = {
+	{ 0, 32, 8, 40, 2, 34, 10, 42 }, { 48, 16, 56, 24, 50, 18, 58, 26 },
+	{ 12, 44, 4, 36, 14, 46, 6, 38 }, { 60, 28, 52, 20, 62, 30, 54, 22 },
+	{ 3, 35, 11, 43, 1, 33, 9, 41 }, { 51, 19, 59, 27, 49, 17, 57, 25 },
+	{ 15, 47, 7, 39, 13, 45, 5, 37 }, { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+/* packs the bits of 8 pixels, black (1) if gray < threshold */
+static void dither_ordered_ref(const uint8_t *gray, const uint8_t *thr,
+		uint8_t *dst, unsigned width) {
+	unsigned x, i;
+	for (x = 0; x < width; x += 8) {
+		unsigned a = 0, n = width - x < 8 ? width - x : 8;
+		for (i = 0; i < n; i++)
+			a |= (gray[x + i] < thr[x + i]) << (7 - i);
+		*dst++ = a;
+	}
+}
+
+#ifdef CKSUM_X86
+static uint8_t dither_rev8[256];
+
+__attribute__((target("sse2")))
+static void dither_ordered_sse2(const uint8_t *gray, const uint8_t *thr,
+		uint8_t *dst, unsigned width) {
+	const __m128i bias = _mm_set1_epi8(-0x80);
+	unsigned x = 0;
+	for (; x + 16 <= width; x += 16) {
+		__m128i g = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(gray + x)), bias);
+		__m128i t = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(thr + x)), bias);
+		unsigned m = _mm_movemask_epi8(_mm_cmplt_epi8(g, t));
+		*dst++ = dither_rev8[m & 0xff];
+		*dst++ = dither_rev8[m >> 8];
+	}
+	if (x < width) dither_ordered_ref(gray + x, thr + x, dst, width - x);
+}
+#endif
+
+typedef void (*dither_fn_t)(const uint8_t*, const uint8_t*, uint8_t*, unsigned);
+
+static dither_fn_t dither_ordered = dither_ordered_ref;
+
+static void dither_init(void) {
+#ifdef CKSUM_X86
+	int i, j;
+	for (i = 0; i < 256; i++) {
+		unsigned a = 0;
+		for (j = 0; j < 8; j++) a |= (i >> j & 1) << (7 - j);
+		dither_rev8[i] = a;
+	}
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) dither_ordered = dither_ordered_sse2;
+#endif
+}
+
+#define DITHER_TEST_LEN 400
+
+/* random rows of all widths up to DITHER_TEST_LEN, at all 16 alignments */
+static int dither_test(void) {
+#ifdef CKSUM_X86
+	uint8_t gray[DITHER_TEST_LEN + 16], thr[DITHER_TEST_LEN + 16];
+	uint8_t a[DITHER_TEST_LEN / 8 + 2], b[sizeof(a)];
+	unsigned seed = 1, off, w, i, fill;
+	int err = 0;
+	dither_init();
+	if (dither_ordered == dither_ordered_ref) {
+		printf("%-10s unsupported\n", "dither_sse2");
+		return 0;
+	}
+	/* fill 1 has only a few levels, so gray == thr is common */
+	for (fill = 0; fill < 2; fill++)
+		for (off = 0; off < 16; off++)
+			for (w = 0; w <= DITHER_TEST_LEN; w++) {
+				for (i = 0; i < w; i++) {
+					seed = seed * 1103515245 + 12345;
+					gray[off + i] = fill ? (seed >> 16) % 4 * 85 : seed >> 16;
+					thr[off + i] = fill ? (seed >> 24) % 4 * 85 : seed >> 24;
+				}
+				memset(a, 0x5a, sizeof(a));
+				memset(b, 0x5a, sizeof(b));
+				dither_ordered_ref(gray + off, thr + off, a, w);
+				dither_ordered_sse2(gray + off, thr + off, b, w);
+				if (memcmp(a, b, sizeof(a))) err++;
+			}
+	printf("%-10s %s\n", "dither_sse2", err ? "FAILED" : "ok");
+	return err;
+#else
+	return 0;
+#endif
+}
+
+static void dither_fs(pnm_img_t *m, uint8_t *dst) {
+	int *cur = m->err + (m->y & 1) * (m->width + 2) + 1;
+	int *next = m->err + (~m->y & 1) * (m->width + 2) + 1;
+	int x, w = m->width;
+	unsigned a = 0;
+	memset(next - 1, 0, (w + 2) * sizeof(*next));
+	for (x = 0; x < w; x++) {
+		int v = m->gray[x] * 16 + cur[x], e;
+		if (v < 128 * 16) e = v, a |= 0x80 >> (x & 7);
+		else e = v - 255 * 16;
+		cur[x + 1] += e * 7 >> 4;
+		next[x - 1] += e * 3 >> 4;
+		next[x] += e * 5 >> 4;
+		next[x + 1] += e >> 4;
+		if ((x & 7) == 7 || x == w - 1) *dst++ = a, a = 0;
+	}
+}
+
+/* reads the next input row to m->row, gray 0..255 in 8.8 fixed point */
+static int pnm_img_read(pnm_img_t *m) {
+	unsigned x, n = m->w * m->chan * m->bytes;
+	uint32_t scale = (255u << 16) / m->maxval;
+	const uint8_t *p = m->in;
+	if (fread(m->in, 1, n, m->f) != n) return -1;
+	for (x = 0; x < m->w; x++) {
+		uint32_t v;
+		if (m->bytes == 2) {
+			v = READ16_BE(p);
+			if (m->chan == 3) // Rec. 601 luma
+				v = (v * 77 + READ16_BE(p + 2) * 150 + READ16_BE(p + 4) * 29) >> 8;
+		} else {
+			v = p[0];
+			if (m->chan == 3)
+				v = (v * 77 + p[1] * 150 + p[2] * 29) >> 8;
+		}
+		p += m->chan * m->bytes;
+		m->row[x] = v * scale >> 8;
+	}
+	m->next++;
+	return 0;
+}
+
+static void pnm_img_close(pnm_img_t *m) {
+	if (m->f && m->f != stdin) fclose(m->f);
+	free(m->in); free(m->row); free(m->acc); free(m->gray);
+	free(m->xmap); free(m->err); free(m->thr);
+	m->f = NULL;
+}
+
+/* "-" is stdin, P4 must be of the printer width */
+static int pnm_img_open(pnm_img_t *m, const char *fn, unsigned width, int dither) {
+	static int init;
+	unsigned x, i;
+	int a;
+	memset(m, 0, sizeof(*m));
+	if (!init++) dither_init();
+	m->f = strcmp(fn, "-") ? fopen(fn, "rb") : stdin;
+	if (!m->f) return -1;
+	if (fgetc(m->f) != 'P') goto err;
+	m->type = fgetc(m->f) - '0';
+	if (m->type < 4 || m->type > 6) goto err;
+	if ((a = pnm_next(m->f)) <= 0) goto err;
+	m->w = a;
+	if ((a = pnm_next(m->f)) <= 0) goto err;
+	m->h = a;
+	m->width = width;
+	m->dither = dither;
+	if (m->type == 4) {
+		if (m->w != width) ERR_EXIT("image width must be %u\n", width);
+		m->height = m->h;
+		return 0;
+	}
+	if ((a = pnm_next(m->f)) <= 0 || a > 0xffff) goto err;
+	m->maxval = a;
+	m->chan = m->type == 6 ? 3 : 1;
+	m->bytes = a > 255 ? 2 : 1;
+	m->height = ((uint64_t)m->h * width + m->w / 2) / m->w;
+	if (!m->height) m->height = 1;
+	m->in = malloc((size_t)m->w * m->chan * m->bytes);
+	m->row = malloc(m->w * sizeof(*m->row));
+	m->acc = malloc(m->w * sizeof(*m->acc));
+	m->gray = malloc(width);
+	m->xmap = malloc(width * 2 * sizeof(*m->xmap));
+	m->err = calloc((width + 2) * 2, sizeof(*m->err));
+	m->thr = malloc(width * 8);
+	if (!m->in || !m->row || !m->acc || !m->gray || !m->xmap || !m->err || !m->thr)
+		ERR_EXIT("malloc failed\n");
+	for (x = 0; x < width; x++) {
+		unsigned x0 = (uint64_t)x * m->w / width;
+		unsigned x1 = (uint64_t)(x + 1) * m->w / width;
+		m->xmap[x * 2] = x0;
+		m->xmap[x * 2 + 1] = x1 > x0 ? x1 : x0 + 1;
+	}
+	for (i = 0; i < 8; i++)
+		for (x = 0; x < width; x++)
+			m->thr[i * width + x] = dither_bayer8[i][x & 7] * 4 + 2;
+	return 0;
+err:
+	pnm_img_close(m);
+	return -1;
+}
+
+/* reads up to "k" packed rows of "st" bytes, returns the number read */
+static unsigned pnm_img_rows(pnm_img_t *m, uint8_t *dst, unsigned k, unsigned st) {
+	unsigned i, x, r;
+	if (m->type == 4) {
+		k = fread(dst, st, k, m->f);
+		m->y += k;
+		return k;
+	}
+	for (i = 0; i < k && m->y < m->height; i++, dst += st) {
+		/* the input rows of this output row, repeated when enlarging */
+		unsigned a = (uint64_t)m->y * m->h / m->height;
+		unsigned b = (uint64_t)(m->y + 1) * m->h / m->height, n;
+		if (b <= a) b = a + 1;
+		memset(m->acc, 0, m->w * sizeof(*m->acc));
+		for (r = a; r < b; r++) {
+			while (m->next <= r)
+				if (pnm_img_read(m)) return i;
+			for (x = 0; x < m->w; x++) m->acc[x] += m->row[x];
+		}
+		n = b - a;
+		for (x = 0; x < m->width; x++) {
+			unsigned x0 = m->xmap[x * 2], x1 = m->xmap[x * 2 + 1], j;
+			uint64_t sum = 0, d = (uint64_t)n * (x1 - x0) << 8;
+			for (j = x0; j < x1; j++) sum += m->acc[j];
+			m->gray[x] = (sum + d / 2) / d;
+		}
+		memset(dst, 0, st);
+		if (m->dither == DITHER_ORDERED)
+			dither_ordered(m->gray, m->thr + (m->y & 7) * m->width, dst, m->width);
+		else
+			dither_fs(m, dst);
+		m->y++;
+	}
+	return i;
+}
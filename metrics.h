@@ -0,0 +1,194 @@
+/*
+ * Metrics in the Prometheus text format, served over HTTP on a TCP
+ * or Unix socket by a separate thread. The values are read from the
+ * counters the main thread updates with plain relaxed stores and from
+ * the seqlocked last samples, so the hot path takes no locks.
+ */
+
+#define METRICS_BUFSIZE 0x8000
+
+typedef struct {
+	char *buf; int pos;
+} metrics_buf_t;
+
+static void metrics_printf(metrics_buf_t *b, const char *fmt, ...) {
+	va_list ap;
+	int n, left = METRICS_BUFSIZE - b->pos;
+	va_start(ap, fmt);
+	n = vsnprintf(b->buf + b->pos, left, fmt, ap);
+	va_end(ap);
+	if (n > 0) b->pos += n < left ? n : left - 1;
+}
+
+static void metrics_head(metrics_buf_t *b, const char *name,
+		const char *type, const char *help) {
+	metrics_printf(b, "# HELP btgadget_%s %s\n# TYPE btgadget_%s %s\n",
+			name, help, name, type);
+}
+
+#define METRICS_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+static void metrics_counter(metrics_buf_t *b, const char *name,
+		const char *help, uint64_t v) {
+	metrics_head(b, name, "counter", help);
+	metrics_printf(b, "btgadget_%s %llu\n", name, (unsigned long long)v);
+}
+
+static void metrics_render(metrics_buf_t *b) {
+	static const struct {
+		int id; const char *name, *help; double scale;
+	} gauge[] = {
+		{ ATF_VOL, "atorch_voltage_volts", "Voltage.", 0.01 },
+		{ ATF_CUR, "atorch_current_amperes", "Current.", 0.01 },
+		{ ATF_POW, "atorch_power_watts", "Power.", 0.01 },
+		{ ATF_CAP, "atorch_capacity_mah", "Device charge counter.", 1 },
+		{ ATF_ENE, "atorch_energy_wh", "Device energy counter.", 0.01 },
+		{ ATF_TEMP, "atorch_temperature_celsius", "Device temperature.", 1 },
+		{ ATF_FREQ, "atorch_frequency_hertz", "AC frequency.", 0.1 },
+		{ ATF_PF, "atorch_power_factor", "AC power factor.", 0.001 },
+		{ ATF_DM, "atorch_dm_volts", "D- voltage.", 0.01 },
+		{ ATF_DP, "atorch_dp_volts", "D+ voltage.", 0.01 },
+	};
+	static const struct {
+		size_t offset; const char *kind;
+	} err[] = {
+		{ offsetof(atorch_link_t, malformed), "malformed" },
+		{ offsetof(atorch_link_t, checksum), "checksum" },
+		{ offsetof(atorch_link_t, reasm), "reassembly" },
+		{ offsetof(atorch_link_t, other), "other" },
+	};
+	atorch_data_t x[ATORCH_MAX_CONN];
+	int i, j, n = METRICS_LOAD(atorch_links.n), have = 0;
+
+	metrics_counter(b, "tx_packets_total", "Packets sent.", METRICS_LOAD(bt_counters.tx_packets));
+	metrics_counter(b, "tx_bytes_total", "Bytes sent.", METRICS_LOAD(bt_counters.tx_bytes));
+	metrics_counter(b, "rx_packets_total", "Packets received.", METRICS_LOAD(bt_counters.rx_packets));
+	metrics_counter(b, "rx_bytes_total", "Bytes received.", METRICS_LOAD(bt_counters.rx_bytes));
+	metrics_counter(b, "requests_total", "ATT requests sent.", METRICS_LOAD(bt_counters.requests));
+	metrics_counter(b, "responses_total", "ATT responses received.", METRICS_LOAD(bt_counters.responses));
+	metrics_counter(b, "notifications_total", "ATT notifications and indications received.",
+			METRICS_LOAD(bt_counters.notifications));
+	metrics_counter(b, "timeouts_total", "Receive timeouts.", METRICS_LOAD(bt_counters.timeouts));
+	metrics_counter(b, "rx_dropped_total", "Frames dropped on a full receive ring.",
+			METRICS_LOAD(bt_counters.rx_dropped));
+	if (!n) return;
+
+	metrics_head(b, "atorch_reports_total", "counter", "Atorch reports received.");
+	for (i = 0; i < n; i++)
+		metrics_printf(b, "btgadget_atorch_reports_total{port=\"%d\"} %llu\n", i,
+				(unsigned long long)METRICS_LOAD(atorch_links.port[i].reports));
+	metrics_head(b, "atorch_samples_total", "counter", "Atorch samples decoded.");
+	for (i = 0; i < n; i++)
+		metrics_printf(b, "btgadget_atorch_samples_total{port=\"%d\"} %llu\n", i,
+				(unsigned long long)METRICS_LOAD(atorch_links.port[i].samples));
+	metrics_head(b, "atorch_errors_total", "counter", "Atorch frames dropped.");
+	for (i = 0; i < n; i++)
+		for (j = 0; j < (int)(sizeof(err) / sizeof(*err)); j++)
+			metrics_printf(b, "btgadget_atorch_errors_total{port=\"%d\",kind=\"%s\"} %llu\n",
+					i, err[j].kind, (unsigned long long)METRICS_LOAD(
+					*(uint64_t*)((char*)&atorch_links.port[i] + err[j].offset)));
+
+	for (i = 0; i < n; i++)
+		if (atorch_latest_get(i, &x[i])) have |= 1 << i;
+	if (!have) return;
+	metrics_head(b, "atorch_sample_timestamp_seconds", "gauge", "Time of the last sample.");
+	for (i = 0; i < n; i++)
+		if (have >> i & 1)
+			metrics_printf(b, "btgadget_atorch_sample_timestamp_seconds{port=\"%d\"} %u.%06u\n",
+					i, (unsigned)(x[i].time / 1000000), (unsigned)(x[i].time % 1000000));
+	for (j = 0; j < (int)(sizeof(gauge) / sizeof(*gauge)); j++) {
+		int id = gauge[j].id, head = 0;
+		for (i = 0; i < n; i++) {
+			if (!(have >> i & 1) || !(x[i].mask >> id & 1)) continue;
+			if (!head++) metrics_head(b, gauge[j].name, "gauge", gauge[j].help);
+			metrics_printf(b, "btgadget_%s{port=\"%d\"} %g\n", gauge[j].name, i,
+					*(int*)((char*)&x[i] + atorch_field[id].offset) * gauge[j].scale);
+		}
+	}
+}
+
+static void metrics_send(int fd, const char *buf, int len) {
+	while (len > 0) {
+		ssize_t ret = send(fd, buf, len, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			return;
+		}
+		buf += ret; len -= ret;
+	}
+}
+
+static void *metrics_thread(void *arg) {
+	int sock = (intptr_t)arg;
+	char *buf = malloc(METRICS_BUFSIZE), req[1024];
+	if (!buf) return NULL;
+	for (;;) {
+		metrics_buf_t b = { buf, 0 };
+		struct pollfd fds = { 0 };
+		char head[128];
+		int fd = accept(sock, NULL, NULL), n;
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			break;
+		}
+		/* the request itself doesn't matter */
+		fds.fd = fd;
+		fds.events = POLLIN;
+		if (poll(&fds, 1, 1000) > 0 && read(fd, req, sizeof(req)) > 0) {
+			metrics_render(&b);
+			n = sprintf(head, "HTTP/1.0 200 OK\r\n"
+					"Content-Type: text/plain; version=0.0.4\r\n"
+					"Content-Length: %d\r\n\r\n", b.pos);
+			metrics_send(fd, head, n);
+			metrics_send(fd, buf, b.pos);
+		}
+		close(fd);
+	}
+	free(buf);
+	return NULL;
+}
+
+/* "addr" is a Unix socket path (with a '/') or [HOST:]PORT */
+static void metrics_init(const char *addr) {
+	pthread_t thread;
+	sigset_t mask, old;
+	int sock, one = 1;
+	if (strchr(addr, '/')) {
+		struct sockaddr_un sa = { 0 };
+		sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sock < 0) PERROR_EXIT(socket);
+		sa.sun_family = AF_UNIX;
+		if (strlen(addr) >= sizeof(sa.sun_path))
+			ERR_EXIT("socket path too long\n");
+		strcpy(sa.sun_path, addr);
+		unlink(addr);
+		if (bind(sock, (struct sockaddr*)&sa, sizeof(sa)) < 0)
+			PERROR_EXIT(bind);
+	} else {
+		struct sockaddr_in sa = { 0 };
+		const char *port = strrchr(addr, ':');
+		char host[64] = "127.0.0.1";
+		if (port) {
+			if (port - addr >= (int)sizeof(host)) ERR_EXIT("bad metrics address\n");
+			memcpy(host, addr, port - addr);
+			host[port++ - addr] = 0;
+		} else port = addr;
+		sa.sin_family = AF_INET;
+		sa.sin_port = htons(atoi(port));
+		if (inet_pton(AF_INET, host, &sa.sin_addr) != 1)
+			ERR_EXIT("bad metrics address\n");
+		sock = socket(AF_INET, SOCK_STREAM, 0);
+		if (sock < 0) PERROR_EXIT(socket);
+		setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(sock, (struct sockaddr*)&sa, sizeof(sa)) < 0)
+			PERROR_EXIT(bind);
+	}
+	if (listen(sock, 8) < 0) PERROR_EXIT(listen);
+	/* the signals are for the main thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old);
+	if (pthread_create(&thread, NULL, metrics_thread, (void*)(intptr_t)sock))
+		ERR_EXIT("pthread_create failed\n");
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_detach(thread);
+}
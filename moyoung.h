@@ -12,24 +12,41 @@ static void moyoung_cmd(btio_t *io, const uint8_t *src, unsigned len) {
 	io->buf[5] = 0x10; // version (0x10, 0x20)
 	io->buf[6] = len + 4;
 	memcpy(io->buf + 7, src, len);
+	bt_stats_vendor = STATS_MOYOUNG << 8 | src[0];
 	bt_send(io, NULL, 7 + len);
 }
 
+enum {
+	MOYOUNG_ERR_RESPONSE = -1, MOYOUNG_ERR_HANDLE = -2,
+	MOYOUNG_ERR_MAGIC = -3, MOYOUNG_ERR_LENGTH = -4
+};
+
+/* validates the first notification of a frame, returns the frame length */
+static int moyoung_check(const uint8_t *buf, int len) {
+	if (buf[0] != 0x1b || len < 6) return MOYOUNG_ERR_RESPONSE;
+	if (READ16_LE(buf + 1) != moyoung_handle[1]) return MOYOUNG_ERR_HANDLE;
+	len -= 3;
+	if (buf[3] != 0xfe || buf[4] != 0xea) return MOYOUNG_ERR_MAGIC;
+	if (buf[6] < len) return MOYOUNG_ERR_LENGTH;
+	return buf[6];
+}
+
 static int moyoung_recv(btio_t *io) {
 	int len = bt_recv(io), len2;
 	if (!len) ERR_EXIT("no response\n");
-	if (io->buf[0] != 0x1b || len < 6)
-		ERR_EXIT("unexpected response\n");
-	if (READ16_LE(io->buf + 1) != moyoung_handle[1]) 
-		ERR_EXIT("unexpected handle\n");
+	len2 = moyoung_check(io->buf, len);
+	switch (len2) {
+	case MOYOUNG_ERR_RESPONSE: ERR_EXIT("unexpected response\n");
+	case MOYOUNG_ERR_HANDLE: ERR_EXIT("unexpected handle\n");
+	case MOYOUNG_ERR_MAGIC: ERR_EXIT("wrong magic\n");
+	case MOYOUNG_ERR_LENGTH: ERR_EXIT("wrong length\n");
+	}
 	len -= 3;
-	if (io->buf[3] != 0xfe || io->buf[4] != 0xea) ERR_EXIT("wrong magic\n");
-	len2 = io->buf[6];
 	if (len2 != len) {
-		if (len2 < len) ERR_EXIT("wrong length\n");
 		len = bt_recv_more(io, len, len2);
 		if (len2 != len) ERR_EXIT("wrong length\n");
 	}
+	timing_mark_once("first_cmd");
 	return len;
 }
 
@@ -98,26 +115,26 @@ static void moyoung_main(btio_t *io, int argc, char **argv) {
 			len = moyoung_recv(io);
 			if (len <= 6 || memcmp(io->buf + 7, cmd, 2))
 				ERR_EXIT("unexpected response\n");
-			DBG_LOG("fw_name = \"");
-			print_esc_str(stderr, io->buf + 3 + 6, len - 6);
-			DBG_LOG("\"\n");
+			out_begin("info", NULL);
+			out_str("fw_name", "fw_name = \"%s\"\n", io->buf + 3 + 6, len - 6);
+			out_end(NULL);
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "getlanguage")) {
 			static const uint8_t cmd[] = { 0x2b };
-			int i, n, len;
+			int i, n, len, list[64];
 			moyoung_cmd(io, cmd, sizeof(cmd));
 			len = moyoung_recv(io);
 			if (len != 14 || io->buf[7] != cmd[0])
 				ERR_EXIT("unexpected response\n");
-			DBG_LOG("language = %u\n", io->buf[8]);
-			DBG_LOG("supported languages:");
 			for (i = n = 0; i < 64; i++) {
 				int a = io->buf[9 + ((i >> 3) ^ 3)];
-				if (a >> (i & 7) & 1)
-					DBG_LOG("%s %u", n++ ? "," : "", i);
+				if (a >> (i & 7) & 1) list[n++] = i;
 			}
-			DBG_LOG("\n");
+			out_begin("language", NULL);
+			out_int("language", "language = %u\n", io->buf[8]);
+			out_list("supported", "supported languages", list, n);
+			out_end(NULL);
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "setlanguage")) {
@@ -136,7 +153,9 @@ static void moyoung_main(btio_t *io, int argc, char **argv) {
 			len = moyoung_recv(io);
 			if (len != 7 || io->buf[7] != cmd[0])
 				ERR_EXIT("unexpected response\n");
-			DBG_LOG("lock_time = %u\n", io->buf[8]);
+			out_begin("autolock", NULL);
+			out_int("lock_time", "lock_time = %u\n", io->buf[8]);
+			out_end(NULL);
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "setautolock")) {
@@ -157,7 +176,9 @@ static void moyoung_main(btio_t *io, int argc, char **argv) {
 			len = moyoung_recv(io);
 			if (len != 6 || io->buf[7] != cmd[0] )
 				ERR_EXIT("unexpected response\n");
-			DBG_LOG("time_format = %u\n", io->buf[8] ? 24 : 12);
+			out_begin("timeformat", NULL);
+			out_int("time_format", "time_format = %u\n", io->buf[8] ? 24 : 12);
+			out_end(NULL);
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "settimeformat")) {
@@ -174,20 +195,18 @@ static void moyoung_main(btio_t *io, int argc, char **argv) {
 
 		} else if (!strcmp(argv[1], "getecardlist")) {
 			static const uint8_t cmd[] = { 0xb9,0x12,0x00,0x02,0x00 };
-			int i, len;
+			int i, len, list[IO_BUFSIZE];
 			moyoung_cmd(io, cmd, sizeof(cmd));
 			len = moyoung_recv(io);
 			if (len < 10 || memcmp(io->buf + 7, cmd, 4))
 				ERR_EXIT("unexpected response\n");
 			len -= 10;
-			DBG_LOG("max_items = %u\n", io->buf[11]);
-			DBG_LOG("max_data = %u\n", io->buf[12]);
-			DBG_LOG("ecard_list:");
-			for (i = 0; i < len; i++) {
-				int a = io->buf[13 + i];
-				DBG_LOG("%s %u", i ? "," : "", a);
-			}
-			DBG_LOG("\n");
+			for (i = 0; i < len; i++) list[i] = io->buf[13 + i];
+			out_begin("ecardlist", NULL);
+			out_int("max_items", "max_items = %u\n", io->buf[11]);
+			out_int("max_data", "max_data = %u\n", io->buf[12]);
+			out_list("ecard_list", "ecard_list", list, len);
+			out_end(NULL);
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "setecardlist")) {
@@ -237,12 +256,12 @@ static void moyoung_main(btio_t *io, int argc, char **argv) {
 			len -= n1;
 			n2 = io->buf[13 + n1];
 			if (len != n2) ERR_EXIT("malformed ecard\n");
-			DBG_LOG("ecard[%u].name = \"", idx);
-			print_esc_str(stderr, io->buf + 13, n1);
-			DBG_LOG("\"\n");
-			DBG_LOG("ecard[%u].data = \"", idx);
-			print_esc_str(stderr, io->buf + 14 + n1, n2);
-			DBG_LOG("\"\n");
+			out_begin("ecard", NULL);
+			out_int("index", "ecard[%u].name = ", idx);
+			out_str("name", "\"%s\"\n", io->buf + 13, n1);
+			out_text("ecard[%u].data = ", idx);
+			out_str("data", "\"%s\"\n", io->buf + 14 + n1, n2);
+			out_end(NULL);
 			argc -= 2; argv += 2;
 
 		} else if (!strcmp(argv[1], "setecard")) {
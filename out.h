@@ -0,0 +1,244 @@
+/*
+ * Output of the results: text (stderr), JSON lines or binary records (stdout).
+ * Records are formatted into a static buffer, without allocations,
+ * and written when the buffer fills up, before waiting for the gadget,
+ * or at exit. Text output is written at the end of each record.
+ *
+ * Binary record:
+ *   u16 length (LE, whole record), u8 type length, type, u64 time (us, LE),
+ *   fields: u8 kind, u8 key length, key, value
+ *   kind 'i': zigzag varint, 'f': u8 decimals + zigzag varint,
+ *   's': varint length + bytes, 'l': varint count + varints
+ */
+
+enum { OUT_TEXT, OUT_JSON, OUT_BIN };
+
+#define OUT_BUFSIZE 0x10000
+/* enough for any single field */
+#define OUT_FIELD_MAX 2048
+
+static struct {
+	int mode, pos, rec;
+	uint8_t buf[OUT_BUFSIZE];
+} bt_out;
+
+static void out_flush(void) {
+	int fd = bt_out.mode == OUT_TEXT ? STDERR_FILENO : STDOUT_FILENO;
+	uint8_t *p = bt_out.buf;
+	int len = bt_out.pos;
+	while (len) {
+		ssize_t ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		p += ret; len -= ret;
+	}
+	bt_out.pos = 0;
+	bt_out.rec = 0;
+}
+
+static uint8_t *out_reserve(int n) {
+	if (bt_out.pos + n > OUT_BUFSIZE) {
+		/* keep the unfinished binary record */
+		int pos = bt_out.pos;
+		int rec = bt_out.mode == OUT_BIN ? bt_out.rec : pos;
+		bt_out.pos = rec;
+		out_flush();
+		memmove(bt_out.buf, bt_out.buf + rec, pos - rec);
+		bt_out.pos = pos - rec;
+	}
+	return bt_out.buf + bt_out.pos;
+}
+
+static void out_raw(const void *data, int len) {
+	memcpy(out_reserve(len), data, len);
+	bt_out.pos += len;
+}
+
+static void out_printf(const char *fmt, ...) {
+	va_list ap;
+	int n;
+	char *p = (char*)out_reserve(OUT_FIELD_MAX);
+	va_start(ap, fmt);
+	n = vsnprintf(p, OUT_FIELD_MAX, fmt, ap);
+	va_end(ap);
+	if (n >= OUT_FIELD_MAX) n = OUT_FIELD_MAX - 1;
+	if (n > 0) bt_out.pos += n;
+}
+
+/* text mode only */
+#define out_text(...) do { \
+	if (bt_out.mode == OUT_TEXT) out_printf(__VA_ARGS__); \
+} while (0)
+
+static void out_varint(uint64_t v) {
+	uint8_t *p = out_reserve(10), *d = p;
+	for (; v >= 0x80; v >>= 7) *d++ = v | 0x80;
+	*d++ = v;
+	bt_out.pos += d - p;
+}
+
+static void out_key(int kind, const char *key) {
+	int n = strlen(key);
+	if (bt_out.mode == OUT_JSON) {
+		out_printf(",\"%s\":", key);
+	} else {
+		uint8_t *p = out_reserve(2 + n);
+		p[0] = kind; p[1] = n;
+		memcpy(p + 2, key, n);
+		bt_out.pos += 2 + n;
+	}
+}
+
+/* starts a record with the timestamp "t" (us since the epoch) */
+static void out_begin_at(const char *type, const char *text, uint64_t t) {
+	if (bt_out.mode == OUT_TEXT) {
+		if (text) out_printf("%s", text);
+		return;
+	}
+	if (bt_out.mode == OUT_JSON) {
+		out_printf("{\"type\":\"%s\",\"time\":%u.%06u", type,
+				(unsigned)(t / 1000000), (unsigned)(t % 1000000));
+	} else {
+		int i, n = strlen(type);
+		uint8_t *p;
+		bt_out.rec = bt_out.pos;
+		p = out_reserve(3 + n + 8);
+		bt_out.rec = bt_out.pos;
+		p[2] = n;
+		memcpy(p + 3, type, n);
+		for (i = 0; i < 8; i++) p[3 + n + i] = t >> i * 8;
+		bt_out.pos += 3 + n + 8;
+	}
+}
+
+static void out_begin(const char *type, const char *text) {
+	out_begin_at(type, text, bt_out.mode == OUT_TEXT ? 0 : get_time_real_us());
+}
+
+static void out_end(const char *text) {
+	if (bt_out.mode == OUT_TEXT) {
+		if (text) out_printf("%s", text);
+		out_flush();
+		return;
+	}
+	if (bt_out.mode == OUT_JSON) {
+		out_raw("}\n", 2);
+	} else {
+		int n = bt_out.pos - bt_out.rec;
+		if (n > 0xffff) ERR_EXIT("record too big\n");
+		WRITE16_LE(bt_out.buf + bt_out.rec, n);
+		bt_out.rec = bt_out.pos;
+	}
+	if (bt_out.pos > OUT_BUFSIZE / 2) out_flush();
+}
+
+static void out_int(const char *key, const char *text, long v) {
+	if (bt_out.mode == OUT_TEXT) out_printf(text, (unsigned)v);
+	else if (bt_out.mode == OUT_JSON) {
+		out_key('i', key);
+		out_printf("%ld", v);
+	} else {
+		out_key('i', key);
+		out_varint((uint64_t)v << 1 ^ -(uint64_t)(v < 0));
+	}
+}
+
+/* fixed point number, text gets the integer and fractional parts */
+static void out_fix(const char *key, const char *text, long v, int dec) {
+	long p = 1; int i;
+	for (i = 0; i < dec; i++) p *= 10;
+	if (bt_out.mode == OUT_TEXT) {
+		const char *d = text;
+		while ((d = strchr(d, '%')) && d[1] == '%') d += 2;
+		if (v < 0 && dec && d) {
+			/* the sign goes before the integer part, which may be 0 */
+			char fmt[128];
+			snprintf(fmt, sizeof(fmt), "%.*s-%s", (int)(d - text), text, d);
+			out_printf(fmt, (int)(labs(v) / p), (unsigned)(labs(v) % p));
+		} else out_printf(text, (int)(v / p), (unsigned)(v % p));
+	} else if (bt_out.mode == OUT_JSON) {
+		out_key('f', key);
+		if (!dec) out_printf("%ld", v);
+		else out_printf("%s%ld.%0*ld", v < 0 ? "-" : "",
+				labs(v) / p, dec, labs(v) % p);
+	} else {
+		out_key('f', key);
+		out_raw(&(uint8_t){ dec }, 1);
+		out_varint((uint64_t)v << 1 ^ -(uint64_t)(v < 0));
+	}
+}
+
+/* the text format has a %s for the escaped string */
+static void out_str(const char *key, const char *text, const uint8_t *buf, int len) {
+	char tmp[OUT_FIELD_MAX * 3 / 4], *d = tmp;
+	int i, a;
+	if (bt_out.mode == OUT_BIN) {
+		out_key('s', key);
+		out_varint(len);
+		out_raw(buf, len);
+		return;
+	}
+	if (len > 255) len = 255;
+	for (i = 0; i < len; i++) {
+		a = buf[i];
+		if (a >= 0x20 && a < 0x7f) {
+			if (a == '"' || a == '\\') *d++ = '\\';
+			*d++ = a;
+		} else if (bt_out.mode == OUT_TEXT) d += sprintf(d, "\\x%02x", a);
+		else d += sprintf(d, "\\u%04x", a);
+	}
+	*d = 0;
+	if (bt_out.mode == OUT_TEXT) {
+		out_printf(text, tmp);
+	} else {
+		out_key('s', key);
+		out_printf("\"%s\"", tmp);
+	}
+}
+
+/* the text format has a %s for the bytes in hex */
+static void out_hex(const char *key, const char *text, const uint8_t *buf, int len) {
+	char tmp[OUT_FIELD_MAX * 3 / 4], *d = tmp;
+	int i;
+	if (bt_out.mode == OUT_BIN) {
+		out_key('s', key);
+		out_varint(len);
+		out_raw(buf, len);
+		return;
+	}
+	if (len > 255) len = 255;
+	for (i = 0; i < len; i++)
+		d += sprintf(d, bt_out.mode == OUT_TEXT && i ? " %02x" : "%02x", buf[i]);
+	*d = 0;
+	if (bt_out.mode == OUT_TEXT) {
+		out_printf(text, tmp);
+	} else {
+		out_key('s', key);
+		out_printf("\"%s\"", tmp);
+	}
+}
+
+static void out_list(const char *key, const char *text, const int *v, int n) {
+	int i;
+	if (bt_out.mode == OUT_TEXT) {
+		out_printf("%s:", text);
+		for (i = 0; i < n; i++) out_printf("%s %u", i ? "," : "", v[i]);
+		out_printf("\n");
+	} else if (bt_out.mode == OUT_JSON) {
+		out_key('l', key);
+		out_raw("[", 1);
+		for (i = 0; i < n; i++) out_printf("%s%d", i ? "," : "", v[i]);
+		out_raw("]", 1);
+	} else {
+		out_key('l', key);
+		out_varint(n);
+		for (i = 0; i < n; i++) out_varint(v[i]);
+	}
+}
+
+static void out_init(int mode) {
+	bt_out.mode = mode;
+	atexit(out_flush);
+}
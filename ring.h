@@ -0,0 +1,156 @@
+/*
+ * Ring file recorder for Atorch samples.
+ * Fixed-size samples in a preallocated memory-mapped file. The header
+ * keeps the total number of written samples, so the recording continues
+ * after a restart and readers can binary search the samples by time.
+ * Fields are stored in host byte order.
+ */
+
+#define RING_MAGIC "BTGRING1"
+#define RING_VERSION 2
+
+typedef struct {
+	char magic[8];
+	uint32_t version, sample_size;
+	uint64_t capacity, head;
+	uint64_t reserved[4];
+} ring_hdr_t;
+
+typedef struct {
+	uint64_t time; // us since the epoch
+	int32_t vol, cur, cap, ene, dm, dp, temp;
+	uint32_t dev_time; // seconds
+	int32_t pow, price, freq, pf; // AC/DC reports
+	uint8_t type, reserved[3];
+	uint32_t mask;
+} ring_sample_t;
+
+/* the file size must fit in off_t */
+#define RING_MAX_CAPACITY ((INT64_MAX - sizeof(ring_hdr_t)) / sizeof(ring_sample_t))
+
+typedef struct {
+	ring_hdr_t *hdr;
+	ring_sample_t *data;
+	size_t size;
+} ring_t;
+
+static ring_t atorch_ring;
+
+static void ring_open(ring_t *r, const char *fn, uint64_t capacity, int write) {
+	struct stat st;
+	ring_hdr_t hdr;
+	void *mem;
+	int fd = open(fn, write ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (fd < 0) PERROR_EXIT(open);
+	if (fstat(fd, &st) < 0) PERROR_EXIT(fstat);
+	if (!st.st_size) {
+		if (!write) ERR_EXIT("empty ring file\n");
+		if (!capacity || capacity > RING_MAX_CAPACITY)
+			ERR_EXIT("bad ring capacity\n");
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, RING_MAGIC, 8);
+		hdr.version = RING_VERSION;
+		hdr.sample_size = sizeof(ring_sample_t);
+		hdr.capacity = capacity;
+		st.st_size = sizeof(hdr) + capacity * sizeof(ring_sample_t);
+		if (ftruncate(fd, st.st_size) < 0) PERROR_EXIT(ftruncate);
+		if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			PERROR_EXIT(pwrite);
+	} else {
+		if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			ERR_EXIT("bad ring file\n");
+		if (memcmp(hdr.magic, RING_MAGIC, 8) ||
+				hdr.version != RING_VERSION ||
+				hdr.sample_size != sizeof(ring_sample_t) ||
+				!hdr.capacity || hdr.capacity > RING_MAX_CAPACITY ||
+				(uint64_t)st.st_size != sizeof(hdr) + hdr.capacity * sizeof(ring_sample_t))
+			ERR_EXIT("bad ring file\n");
+		if (capacity && capacity != hdr.capacity)
+			DBG_LOG("ring capacity is %u, keeping it\n", (unsigned)hdr.capacity);
+	}
+	mem = mmap(NULL, st.st_size, write ? PROT_READ | PROT_WRITE : PROT_READ,
+			MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) PERROR_EXIT(mmap);
+	close(fd);
+	r->hdr = mem;
+	r->data = (ring_sample_t*)(r->hdr + 1);
+	r->size = st.st_size;
+}
+
+static void ring_close(ring_t *r) {
+	if (!r->hdr) return;
+	munmap(r->hdr, r->size);
+	r->hdr = NULL;
+}
+
+static void ring_sample_set(ring_sample_t *s, const atorch_data_t *x) {
+	s->time = x->time;
+	s->vol = x->vol; s->cur = x->cur;
+	s->cap = x->cap; s->ene = x->ene;
+	s->dm = x->dm; s->dp = x->dp;
+	s->temp = x->temp;
+	s->dev_time = x->hour * 3600 + x->min * 60 + x->sec;
+	s->pow = x->pow; s->price = x->price;
+	s->freq = x->freq; s->pf = x->pf;
+	s->type = x->type;
+	memset(s->reserved, 0, sizeof(s->reserved));
+	s->mask = x->mask;
+}
+
+static void ring_append(ring_t *r, const atorch_data_t *x) {
+	uint64_t head = r->hdr->head;
+	ring_sample_set(r->data + head % r->hdr->capacity, x);
+	__atomic_store_n(&r->hdr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t ring_first(ring_t *r) {
+	uint64_t head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+	return head > r->hdr->capacity ? head - r->hdr->capacity : 0;
+}
+
+static ring_sample_t *ring_get(ring_t *r, uint64_t i) {
+	return r->data + i % r->hdr->capacity;
+}
+
+/* index of the first sample at or after "time" */
+static uint64_t ring_seek(ring_t *r, uint64_t time) {
+	uint64_t lo = ring_first(r), hi = r->hdr->head;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (ring_get(r, mid)->time < time) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static void ring_sample_data(const ring_sample_t *s, atorch_data_t *x) {
+	memset(x, 0, sizeof(*x));
+	x->time = s->time;
+	x->vol = s->vol; x->cur = s->cur;
+	x->cap = s->cap; x->ene = s->ene;
+	x->dm = s->dm; x->dp = s->dp;
+	x->temp = s->temp;
+	x->hour = s->dev_time / 3600;
+	x->min = s->dev_time / 60 % 60;
+	x->sec = s->dev_time % 60;
+	x->pow = s->pow; x->price = s->price;
+	x->freq = s->freq; x->pf = s->pf;
+	x->type = s->type;
+	x->mask = s->mask;
+}
+
+/* times in seconds since the epoch */
+static void ring_dump(const char *fn, double from, double to) {
+	ring_t r;
+	uint64_t i, head;
+	ring_open(&r, fn, 0, 0);
+	head = r.hdr->head;
+	for (i = ring_seek(&r, from * 1e6); i < head; i++) {
+		const ring_sample_t *s = ring_get(&r, i);
+		atorch_data_t x;
+		if (s->time > to * 1e6) break;
+		ring_sample_data(s, &x);
+		atorch_print(&x, ATORCH_PRINT_TIME);
+	}
+	ring_close(&r);
+}
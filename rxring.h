@@ -0,0 +1,132 @@
+/*
+ * Optional receive thread. It drains the socket into a single-producer
+ * single-consumer ring of preallocated frame slots, so a consumer blocked
+ * on output doesn't leave the frames in the kernel queue. The consumer
+ * sleeps on a pipe, the thread writes to it only when the ring was empty.
+ * Frames that arrive when the ring is full are counted and dropped.
+ */
+
+typedef struct {
+	uint32_t len;
+	uint8_t data[IO_BUFSIZE];
+} rx_slot_t;
+
+struct rx_ring {
+	uint32_t head, tail, mask;
+	int closed, sock, pipe[2];
+	rx_slot_t *slot;
+	pthread_t thread;
+};
+
+static int bt_rx_slots;
+
+#define RX_LOAD(x) __atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define RX_STORE(x, v) __atomic_store_n(&(x), v, __ATOMIC_SEQ_CST)
+
+static void *rx_ring_thread(void *arg) {
+	rx_ring_t *r = arg;
+	uint8_t skip[IO_BUFSIZE];
+	for (;;) {
+		uint32_t head = r->head;
+		int full = head - RX_LOAD(r->tail) > r->mask, len;
+		uint8_t *buf = full ? skip : r->slot[head & r->mask].data;
+		len = read(r->sock, buf, IO_BUFSIZE);
+		if (len < 0 && errno == EINTR) continue;
+		if (len <= 0) break;
+		if (full) {
+			COUNTER_ADD(rx_dropped, 1);
+			continue;
+		}
+		r->slot[head & r->mask].len = len;
+		RX_STORE(r->head, head + 1);
+		// the consumer may be waiting
+		if (RX_LOAD(r->tail) == head && write(r->pipe[1], "", 1) < 0) {}
+	}
+	RX_STORE(r->closed, 1);
+	if (write(r->pipe[1], "", 1) < 0) {}
+	return NULL;
+}
+
+static void rx_ring_drain(rx_ring_t *r) {
+	char buf[64];
+	while (read(r->pipe[0], buf, sizeof(buf)) > 0);
+}
+
+/* works like poll() on the socket, frames are read with rx_ring_pop() */
+static int rx_ring_poll(rx_ring_t *r, short *revents, int timeout) {
+	uint64_t end = get_time_ms() + timeout;
+	for (;;) {
+		struct pollfd fds = { 0 };
+		int ret, closed = RX_LOAD(r->closed);
+		if (RX_LOAD(r->head) != r->tail) {
+			*revents = POLLIN;
+			return 1;
+		}
+		if (closed) {
+			*revents = POLLHUP;
+			return 1;
+		}
+		fds.fd = r->pipe[0];
+		fds.events = POLLIN;
+		ret = poll(&fds, 1, timeout);
+		if (ret <= 0) return ret;
+		rx_ring_drain(r);
+		if (timeout > 0) {
+			uint64_t t = get_time_ms();
+			timeout = t < end ? (int)(end - t) : 0;
+		}
+	}
+}
+
+/* true if a frame (or the end) can be taken without waiting */
+static int rx_ring_ready(rx_ring_t *r) {
+	int closed = RX_LOAD(r->closed);
+	return RX_LOAD(r->head) != r->tail || closed;
+}
+
+static int rx_ring_pop(rx_ring_t *r, uint8_t *buf) {
+	rx_slot_t *s = &r->slot[r->tail & r->mask];
+	int len;
+	/* the slot is complete only once head is past it */
+	if (RX_LOAD(r->head) == r->tail) return 0;
+	len = s->len;
+	memcpy(buf, s->data, len);
+	RX_STORE(r->tail, r->tail + 1);
+	return len;
+}
+
+/* "n" is rounded up to a power of two */
+static void rx_ring_start(btio_t *io, int n) {
+	rx_ring_t *r;
+	sigset_t mask, old;
+	int i, k = 1;
+	while (k < n && k < 1 << 20) k <<= 1;
+	r = calloc(1, sizeof(*r));
+	if (!r || !(r->slot = malloc(k * sizeof(rx_slot_t))))
+		ERR_EXIT("malloc failed\n");
+	r->mask = k - 1;
+	r->sock = io->sock;
+	if (pipe(r->pipe) < 0) PERROR_EXIT(pipe);
+	for (i = 0; i < 2; i++)
+		fcntl(r->pipe[i], F_SETFL, fcntl(r->pipe[i], F_GETFL) | O_NONBLOCK);
+	/* the signals are for the main thread */
+	sigfillset(&mask);
+	pthread_sigmask(SIG_SETMASK, &mask, &old);
+	if (pthread_create(&r->thread, NULL, rx_ring_thread, r))
+		ERR_EXIT("pthread_create failed\n");
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	io->rx = r;
+}
+
+/* call before closing the socket */
+static void rx_ring_stop(btio_t *io) {
+	rx_ring_t *r = io->rx;
+	if (!r) return;
+	shutdown(io->sock, SHUT_RDWR);
+	pthread_join(r->thread, NULL);
+	close(r->pipe[0]);
+	close(r->pipe[1]);
+	free(r->slot);
+	free(r);
+	io->rx = NULL;
+}
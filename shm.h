@@ -0,0 +1,96 @@
+/*
+ * Live feed of Atorch samples in POSIX shared memory.
+ * The writer keeps the last SHM_HISTORY samples under a seqlock: the
+ * sequence is odd while the segment is updated, readers copy the samples
+ * and retry if the sequence changed, so they never block the writer and
+ * need no syscalls after the mapping. The segment is left in place at exit.
+ */
+
+#define SHM_MAGIC "BTGSHM01"
+#define SHM_VERSION 2
+#define SHM_HISTORY 64
+
+typedef struct {
+	char magic[8];
+	uint32_t version, sample_size, history, seq;
+	uint64_t count;
+	uint64_t reserved[4];
+	ring_sample_t hist[SHM_HISTORY];
+} shm_feed_t;
+
+static shm_feed_t *atorch_shm;
+
+static shm_feed_t *shm_feed_open(const char *name, int write) {
+	shm_feed_t *f;
+	int fd = shm_open(name, write ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+	if (fd < 0) PERROR_EXIT(shm_open);
+	if (write && ftruncate(fd, sizeof(*f)) < 0) PERROR_EXIT(ftruncate);
+	f = mmap(NULL, sizeof(*f), write ? PROT_READ | PROT_WRITE : PROT_READ,
+			MAP_SHARED, fd, 0);
+	if (f == MAP_FAILED) PERROR_EXIT(mmap);
+	close(fd);
+	if (write) {
+		__atomic_store_n(&f->seq, f->seq | 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		if (memcmp(f->magic, SHM_MAGIC, 8) || f->version != SHM_VERSION) {
+			memset(f->hist, 0, sizeof(f->hist));
+			f->count = 0;
+		}
+		memcpy(f->magic, SHM_MAGIC, 8);
+		f->version = SHM_VERSION;
+		f->sample_size = sizeof(ring_sample_t);
+		f->history = SHM_HISTORY;
+		__atomic_store_n(&f->seq, f->seq + 1, __ATOMIC_RELEASE);
+	} else if (memcmp(f->magic, SHM_MAGIC, 8) || f->version != SHM_VERSION ||
+			f->sample_size != sizeof(ring_sample_t) || f->history != SHM_HISTORY)
+		ERR_EXIT("bad shared memory segment\n");
+	return f;
+}
+
+static void shm_feed_publish(shm_feed_t *f, const atorch_data_t *x) {
+	uint32_t seq = f->seq;
+	ring_sample_t *s = f->hist + f->count % SHM_HISTORY;
+	__atomic_store_n(&f->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	ring_sample_set(s, x);
+	f->count++;
+	__atomic_store_n(&f->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies up to "n" last samples, oldest first.
+ * Returns the number of samples, "count" gets the total published.
+ */
+static int shm_feed_read(const shm_feed_t *f, ring_sample_t *out, int n, uint64_t *count) {
+	uint32_t seq;
+	uint64_t c;
+	int i;
+	if (n > SHM_HISTORY) n = SHM_HISTORY;
+	do {
+		while ((seq = __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE)) & 1);
+		c = f->count;
+		if ((uint64_t)n > c) n = c;
+		for (i = 0; i < n; i++)
+			out[i] = f->hist[(c - n + i) % SHM_HISTORY];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&f->seq, __ATOMIC_RELAXED) != seq);
+	if (count) *count = c;
+	return n;
+}
+
+static void shm_feed_dump(const char *name, int n) {
+	ring_sample_t buf[SHM_HISTORY];
+	shm_feed_t *f = shm_feed_open(name, 0);
+	uint64_t count;
+	int i;
+	n = shm_feed_read(f, buf, n, &count);
+	out_begin("shmfeed", NULL);
+	out_int("count", "count = %u\n", count);
+	out_end(NULL);
+	for (i = 0; i < n; i++) {
+		atorch_data_t x;
+		ring_sample_data(buf + i, &x);
+		atorch_print(&x, ATORCH_PRINT_TIME);
+	}
+	munmap(f, sizeof(*f));
+}
@@ -0,0 +1,595 @@
+/*
+ * Gadget simulator, plays the peripheral side of the supported protocols.
+ * ATT: one GATT database with the Battery, Atorch (0xffe0),
+ * TJD (0x18d0) and Moyoung (0xfeea) services.
+ * RFCOMM: YHK mini printer.
+ */
+
+static struct {
+	int latency, loss, mtu, period, atorch;
+	int paper, speed; // YHK: rows until the paper runs out, rows/s
+} sim_conf = { 0, 0, 23, 1000, 3, 0, 0 };
+
+typedef struct {
+	int fd, mtu;
+	unsigned rand;
+	uint64_t next;
+	/* TJD state */
+	uint8_t tjd_lang[3], tjd_dial[6];
+	int tjd_ui, tjd_func;
+	/* Moyoung state */
+	int moy_lang, moy_lock, moy_24h;
+	uint8_t moy_list[16]; int moy_nlist;
+	char moy_ecard[16][2][32];
+	/* Atorch state */
+	unsigned vol, cur, secs;
+	uint64_t cap, ene;
+} sim_t;
+
+typedef struct {
+	uint16_t handle, type;
+	uint8_t len, val[19];
+} sim_attr_t;
+
+#define SIM_SVC(h, u) { h, 0x2800, 2, { (u) & 0xff, (u) >> 8 } },
+#define SIM_CHAR(h, prop, u) \
+	{ h, 0x2803, 5, { prop, (h + 1) & 0xff, (h + 1) >> 8, (u) & 0xff, (u) >> 8 } }, \
+	{ h + 1, u, 0, { 0 } },
+#define SIM_CCCD(h) { h, 0x2902, 2, { 0, 0 } },
+
+static sim_attr_t sim_attr[] = {
+	SIM_SVC(0x01, 0x1800)
+	SIM_CHAR(0x02, 0x02, 0x2a00)
+	SIM_SVC(0x06, 0x180f)
+	SIM_CHAR(0x07, 0x12, 0x2a19)
+	SIM_CCCD(0x09)
+	SIM_SVC(0x0a, 0xffe0)
+	SIM_CHAR(0x0b, 0x1e, 0xffe1)
+	SIM_CCCD(0x0d)
+	SIM_SVC(0x19, 0x18d0)
+	SIM_CHAR(0x1a, 0x0c, 0x2d01)
+	SIM_CHAR(0x1d, 0x10, 0x2d00)
+	SIM_CCCD(0x1f)
+	SIM_SVC(0x30, 0xfeea)
+	SIM_CHAR(0x31, 0x0c, 0xfee2)
+	SIM_CHAR(0x33, 0x10, 0xfee3)
+	SIM_CCCD(0x35)
+};
+#undef SIM_SVC
+#undef SIM_CHAR
+#undef SIM_CCCD
+
+#define SIM_NATTR (int)(sizeof(sim_attr) / sizeof(*sim_attr))
+
+static sim_attr_t *sim_find(int handle) {
+	int i;
+	for (i = 0; i < SIM_NATTR; i++)
+		if (sim_attr[i].handle == handle) return sim_attr + i;
+	return NULL;
+}
+
+static int sim_svc_end(int i) {
+	for (i++; i < SIM_NATTR; i++)
+		if (sim_attr[i].type == 0x2800) return sim_attr[i].handle - 1;
+	return sim_attr[SIM_NATTR - 1].handle;
+}
+
+static int sim_notify_on(int cccd) {
+	sim_attr_t *a = sim_find(cccd);
+	return a && a->val[0] & 3;
+}
+
+static int sim_rand(sim_t *s) {
+	s->rand = s->rand * 1103515245 + 12345;
+	return s->rand >> 16 & 0x7fff;
+}
+
+static void sim_send(sim_t *s, const uint8_t *buf, int len) {
+	if (sim_conf.latency > 0) usleep(sim_conf.latency * 1000);
+	if (write(s->fd, buf, len) != len) _exit(0);
+}
+
+static void sim_error(sim_t *s, int op, int handle, int err) {
+	uint8_t buf[5] = { 0x01, op };
+	WRITE16_LE(buf + 2, handle);
+	buf[4] = err;
+	sim_send(s, buf, 5);
+}
+
+/* long values are split over several notifications, like the real gadgets do */
+static void sim_notify(sim_t *s, int handle, const uint8_t *data, int len) {
+	uint8_t buf[IO_BUFSIZE];
+	int n, max = s->mtu - 3;
+	do {
+		n = len < max ? len : max;
+		buf[0] = 0x1b;
+		WRITE16_LE(buf + 1, handle);
+		memcpy(buf + 3, data, n);
+		if (sim_rand(s) % 100 >= sim_conf.loss)
+			sim_send(s, buf, n + 3);
+		data += n; len -= n;
+	} while (len > 0);
+}
+
+static void sim_tjd_reply(sim_t *s, const uint8_t *src, int len) {
+	uint8_t buf[20] = { 0x5a, len + 3 };
+	memcpy(buf + 2, src, len);
+	buf[len + 2] = tjd_crc8(buf, len + 2);
+	/* the firmware pads notifications with zeros */
+	if (sim_notify_on(0x1f)) sim_notify(s, 0x1e, buf, 20);
+}
+
+static void sim_tjd(sim_t *s, const uint8_t *p, int len) {
+	uint8_t r[17] = { 0 };
+	int n = 0;
+	if (len < 2 || p[0] != 0xab) return;
+	/* dialpush/wallpush data, no length and checksum */
+	if (len == 20 && (p[1] == 0x29 || p[1] == 0x2c)) return;
+	if (p[1] != len || tjd_crc8(p, len - 1) != p[len - 1]) return;
+	p += 2; len -= 3;
+	if (len < 1) return;
+	r[0] = p[0];
+	switch (p[0]) {
+	case 0x00:
+		WRITE16_LE(r + 1, 0x0fff);
+		WRITE16_BE(r + 3, 0x0001);
+		WRITE32_BE(r + 5, 0x53494d31);
+		r[9] = 1; r[10] = 0; r[11] = 2; r[12] = 3;
+		WRITE32_BE(r + 13, 0x00000001);
+		n = 17; break;
+	case 0x39:
+		r[1] = 0;
+		WRITE16_BE(r + 2, 240);
+		WRITE16_BE(r + 4, 240);
+		WRITE16_BE(r + 6, 0x1000);
+		n = 8; break;
+	case 0x03: r[1] = 90; n = 2; break;
+	case 0x09: case 0x04: case 0x21:
+		if (p[0] == 0x21 && len > 1) s->tjd_lang[0] = p[1];
+		r[1] = 1; n = 2; break;
+	case 0x28: case 0x2b: r[1] = 1; n = 2; break;
+	case 0x02:
+		if (len < 2 || p[1]) break;
+		r[1] = 0; memcpy(r + 2, s->tjd_lang, 3); n = 5; break;
+	case 0x2e:
+		if (len < 2) break;
+		r[1] = p[1];
+		if (p[1] == 1 && len >= 8) memcpy(s->tjd_dial, p + 2, 6);
+		n = 2;
+		if (!p[1]) { memcpy(r + 2, s->tjd_dial, 6); n = 8; }
+		break;
+	case 0x07: case 0x08: {
+		int *mask = p[0] == 0x07 ? &s->tjd_ui : &s->tjd_func;
+		if (len < 2) break;
+		r[1] = p[1];
+		if (p[1] == 1 && len >= 4) *mask = READ16_BE(p + 2);
+		n = 2;
+		if (!p[1]) { WRITE16_BE(r + 2, *mask); n = 4; }
+		break;
+	}
+	}
+	if (n) sim_tjd_reply(s, r, n);
+}
+
+static void sim_moyoung_reply(sim_t *s, const uint8_t *src, int len) {
+	uint8_t buf[IO_BUFSIZE];
+	buf[0] = 0xfe; buf[1] = 0xea; buf[2] = 0x10;
+	buf[3] = len + 4;
+	memcpy(buf + 4, src, len);
+	if (sim_notify_on(0x35)) sim_notify(s, 0x34, buf, len + 4);
+}
+
+static void sim_moyoung(sim_t *s, const uint8_t *p, int len) {
+	uint8_t r[IO_BUFSIZE - 8];
+	int n = 0;
+	if (len < 5 || p[0] != 0xfe || p[1] != 0xea || p[3] != len) return;
+	p += 4; len -= 4;
+	r[0] = p[0];
+	switch (p[0]) {
+	case 0x5a:
+		if (len < 2) break;
+		r[1] = p[1];
+		n = sprintf((char*)r + 2, p[1] ? "SIM-FW-1.0" : "SIM-API") + 2;
+		break;
+	case 0x2b:
+		r[1] = s->moy_lang;
+		memset(r + 2, 0, 8);
+		r[2 + (0 ^ 3)] = 0xff;
+		n = 10; break;
+	case 0x1b: if (len > 1) s->moy_lang = p[1]; break;
+	case 0x8d: r[1] = s->moy_lock; r[2] = 0; n = 3; break;
+	case 0x7d: if (len > 1) s->moy_lock = p[1]; break;
+	case 0x27: r[1] = s->moy_24h; n = 2; break;
+	case 0x17: if (len > 1) s->moy_24h = p[1]; break;
+	case 0xb9:
+		if (len < 4) break;
+		memcpy(r, p, 4);
+		if (p[1] == 0x12 && p[3] == 0x02) {
+			r[4] = 16; r[5] = 32;
+			memcpy(r + 6, s->moy_list, s->moy_nlist);
+			n = 6 + s->moy_nlist;
+		} else if (p[1] == 0x12 && p[3] == 0x03 && len > 4) {
+			int n1, n2, i = p[4] & 15;
+			n1 = strlen(s->moy_ecard[i][0]);
+			n2 = strlen(s->moy_ecard[i][1]);
+			r[4] = p[4]; r[5] = n1;
+			memcpy(r + 6, s->moy_ecard[i][0], n1);
+			r[6 + n1] = n2;
+			memcpy(r + 7 + n1, s->moy_ecard[i][1], n2);
+			n = 7 + n1 + n2;
+		} else if (p[1] == 0x02 && p[3] == 0x04) {
+			n = len - 4 < 16 ? len - 4 : 16;
+			memcpy(s->moy_list, p + 4, n);
+			s->moy_nlist = n; n = 0;
+		} else if (p[1] == 0x02 && p[3] == 0x00 && len > 6) {
+			int n1 = p[5], n2, i = p[4] & 15;
+			if (6 + n1 >= len) break;
+			n2 = p[6 + n1];
+			if (7 + n1 + n2 > len || n1 > 31 || n2 > 31) break;
+			memcpy(s->moy_ecard[i][0], p + 6, n1);
+			s->moy_ecard[i][0][n1] = 0;
+			memcpy(s->moy_ecard[i][1], p + 7 + n1, n2);
+			s->moy_ecard[i][1][n2] = 0;
+		} else if (p[1] == 0x02 && p[3] == 0x01 && len > 4) {
+			s->moy_ecard[p[4] & 15][0][0] = 0;
+			s->moy_ecard[p[4] & 15][1][0] = 0;
+		}
+		break;
+	}
+	if (n) sim_moyoung_reply(s, r, n);
+}
+
+/* AC (1) and DC (2) meter reports */
+static void sim_atorch_meter(sim_t *s, uint8_t *buf) {
+	unsigned t = s->secs++, ac = buf[3] == 1;
+	s->vol = ac ? 2300 + sim_rand(s) % 20 : 120 + sim_rand(s) % 5;
+	s->cur = ac ? 450 + sim_rand(s) % 100 : 1000 + sim_rand(s) % 50;
+	/* 0.1 V * mA, 1e-4 W*s */
+	s->cap += s->cur;
+	s->ene += s->vol * s->cur;
+	WRITE16_BE(buf + 4, s->vol >> 8); buf[6] = s->vol;
+	WRITE16_BE(buf + 7, s->cur >> 8); buf[9] = s->cur;
+	if (ac) {
+		unsigned pow = s->vol * s->cur / 1000;
+		WRITE16_BE(buf + 10, pow >> 8); buf[12] = pow;
+		WRITE16_BE(buf + 20, 500);
+		WRITE16_BE(buf + 22, 950);
+	} else {
+		WRITE16_BE(buf + 10, s->cap / 36000 >> 8); buf[12] = s->cap / 36000;
+	}
+	WRITE32_BE(buf + 13, s->ene / 360000000);
+	buf[19] = 50;
+	WRITE16_BE(buf + 24, 25);
+	WRITE16_BE(buf + 26, t / 3600);
+	buf[28] = t / 60 % 60;
+	buf[29] = t % 60;
+}
+
+static void sim_atorch_usb(sim_t *s, uint8_t *buf) {
+	unsigned t = s->secs++;
+	s->vol = 500 + sim_rand(s) % 24;
+	s->cur = 95 + sim_rand(s) % 10;
+	/* one report per second of device time, mA*s and 1e-4 W*s */
+	s->cap += s->cur * 10;
+	s->ene += s->vol * s->cur;
+	WRITE16_BE(buf + 4, s->vol >> 8); buf[6] = s->vol;
+	WRITE16_BE(buf + 7, s->cur >> 8); buf[9] = s->cur;
+	WRITE16_BE(buf + 10, s->cap / 3600 >> 8); buf[12] = s->cap / 3600;
+	WRITE32_BE(buf + 13, s->ene / 360000);
+	WRITE16_BE(buf + 17, 60);
+	WRITE16_BE(buf + 19, 60);
+	WRITE16_BE(buf + 21, 25);
+	WRITE16_BE(buf + 23, t / 3600);
+	buf[25] = t / 60 % 60;
+	buf[26] = t % 60;
+	buf[27] = 0x3c; buf[28] = 0x0c; buf[29] = 0x80;
+	buf[32] = 0x03; buf[33] = 0x20;
+}
+
+static void sim_atorch_report(sim_t *s) {
+	uint8_t buf[36] = { 0xff, 0x55, 0x01 };
+	buf[3] = sim_conf.atorch;
+	if (buf[3] == 3) sim_atorch_usb(s, buf);
+	else sim_atorch_meter(s, buf);
+	buf[35] = atorch_checksum(buf + 3, 36 - 4);
+	sim_notify(s, 0x0c, buf, 36);
+}
+
+static void sim_att(sim_t *s, const uint8_t *p, int len) {
+	uint8_t r[IO_BUFSIZE];
+	int i, n, start, end, type, op = p[0];
+	sim_attr_t *a;
+
+	if (len >= 5 && op != 0x0a && op != 0x12 && op != 0x52) {
+		start = READ16_LE(p + 1);
+		end = READ16_LE(p + 3);
+		if (!start || start > end) {
+			sim_error(s, op, start, 0x01);
+			return;
+		}
+	} else start = end = 0;
+
+	switch (op) {
+	case 0x02: // Exchange MTU Request
+		if (len != 3) break;
+		i = READ16_LE(p + 1);
+		r[0] = 0x03;
+		WRITE16_LE(r + 1, sim_conf.mtu);
+		sim_send(s, r, 3);
+		if (i < sim_conf.mtu) s->mtu = i;
+		return;
+
+	case 0x04: // Find Information Request
+		if (len != 5) break;
+		r[0] = 0x05; r[1] = 0x01; n = 2;
+		for (i = 0; i < SIM_NATTR && n + 4 <= s->mtu; i++) {
+			a = sim_attr + i;
+			if (a->handle < start || a->handle > end) continue;
+			WRITE16_LE(r + n, a->handle);
+			WRITE16_LE(r + n + 2, a->type);
+			n += 4;
+		}
+		if (n == 2) break;
+		sim_send(s, r, n);
+		return;
+
+	case 0x06: // Find By Type Value Request
+		if (len != 9 || READ16_LE(p + 5) != 0x2800) break;
+		r[0] = 0x07; n = 1;
+		for (i = 0; i < SIM_NATTR && n + 4 <= s->mtu; i++) {
+			a = sim_attr + i;
+			if (a->handle < start || a->handle > end) continue;
+			if (a->type != 0x2800 || READ16_LE(a->val) != READ16_LE(p + 7)) continue;
+			WRITE16_LE(r + n, a->handle);
+			WRITE16_LE(r + n + 2, sim_svc_end(i));
+			n += 4;
+		}
+		if (n == 1) break;
+		sim_send(s, r, n);
+		return;
+
+	case 0x08: // Read By Type Request
+	case 0x10: // Read By Group Type Request
+		if (len != 7) break;
+		type = READ16_LE(p + 5);
+		r[0] = op + 1; r[1] = 0; n = 2;
+		for (i = 0; i < SIM_NATTR; i++) {
+			int k = 2 + sim_attr[i].len + (op == 0x10 ? 2 : 0);
+			a = sim_attr + i;
+			if (a->handle < start || a->handle > end) continue;
+			if (a->type != type) continue;
+			if (r[1] && r[1] != k) break;
+			if (n + k > s->mtu) break;
+			r[1] = k;
+			WRITE16_LE(r + n, a->handle);
+			if (op == 0x10) WRITE16_LE(r + n + 2, sim_svc_end(i));
+			memcpy(r + n + k - a->len, a->val, a->len);
+			n += k;
+		}
+		if (n == 2) break;
+		sim_send(s, r, n);
+		return;
+
+	case 0x0a: // Read Request
+		if (len != 3) break;
+		start = READ16_LE(p + 1);
+		if (!(a = sim_find(start))) break;
+		r[0] = 0x0b;
+		memcpy(r + 1, a->val, a->len);
+		sim_send(s, r, 1 + a->len);
+		return;
+
+	case 0x12: // Write Request
+	case 0x52: // Write Command
+		if (len < 3) return;
+		start = READ16_LE(p + 1);
+		if (!(a = sim_find(start))) {
+			if (op == 0x12) sim_error(s, op, start, 0x01);
+			return;
+		}
+		if (a->type == 0x2902 && len == 5) memcpy(a->val, p + 3, 2);
+		else if (a->type != 0x2800 && a->type != 0x2803 &&
+				len - 3 <= (int)sizeof(a->val)) {
+			a->len = len - 3;
+			memcpy(a->val, p + 3, a->len);
+		}
+		if (op == 0x12) {
+			r[0] = 0x13;
+			sim_send(s, r, 1);
+		}
+		if (start == 0x1b) sim_tjd(s, p + 3, len - 3);
+		if (start == 0x32) sim_moyoung(s, p + 3, len - 3);
+		return;
+
+	case 0x01: // Error Response
+	case 0x1e: // Handle Value Confirmation
+		return;
+
+	default:
+		if (op & 0x40) return; // commands don't have responses
+		sim_error(s, op, 0, 0x06);
+		return;
+	}
+	sim_error(s, op, start, 0x0a);
+}
+
+static void sim_att_main(int fd) {
+	uint8_t buf[IO_BUFSIZE];
+	sim_t sim_buf, *s = &sim_buf;
+	sim_attr_t *a;
+	memset(s, 0, sizeof(*s));
+	s->fd = fd;
+	s->mtu = sim_conf.mtu;
+	if (s->mtu < 23) s->mtu = 23;
+	if (s->mtu > IO_BUFSIZE) s->mtu = IO_BUFSIZE;
+	s->rand = getpid();
+	a = sim_find(0x03);
+	memcpy(a->val, "btgadget-sim", a->len = 12);
+	a = sim_find(0x08);
+	a->len = 1; a->val[0] = 90;
+	s->tjd_lang[1] = 0; s->tjd_lang[2] = 0;
+	s->moy_24h = 1; s->moy_lock = 10;
+	strcpy(s->moy_ecard[0][0], "sim");
+	strcpy(s->moy_ecard[0][1], "https://example.com");
+	s->moy_list[0] = 0; s->moy_nlist = 1;
+	s->next = get_time_ms() + sim_conf.period;
+
+	for (;;) {
+		struct pollfd fds = { 0 };
+		int ret, len, timeout = -1;
+		if (sim_notify_on(0x0d)) {
+			uint64_t t = get_time_ms();
+			if (t >= s->next) {
+				sim_atorch_report(s);
+				s->next += sim_conf.period;
+				if (s->next < t) s->next = t + sim_conf.period;
+				continue;
+			}
+			timeout = s->next - t;
+		}
+		fds.fd = fd;
+		fds.events = POLLIN;
+		ret = poll(&fds, 1, timeout);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (!ret) continue;
+		len = read(fd, buf, sizeof(buf));
+		if (len <= 0) break;
+		sim_att(s, buf, len);
+	}
+}
+
+static void sim_yhk_main(int fd) {
+	static const char info[] = "SIM,DPI=384,VER=1.0";
+	uint8_t buf[4096], cmd[8];
+	unsigned long skip = 0, rows = 0, feed = 0, st = 1;
+	uint64_t nopaper = 0; // the paper is reloaded a second later
+	int i, len, n = 0, need = 1;
+	for (;;) {
+		len = read(fd, buf, sizeof(buf));
+		if (len <= 0) break;
+		for (i = 0; i < len; ) {
+			if (skip) {
+				unsigned long k = len - i;
+				if (k > skip) k = skip;
+				skip -= k; i += k;
+				if (sim_conf.speed > 0)
+					usleep(k * 1000000ull / st / sim_conf.speed);
+				continue;
+			}
+			cmd[n++] = buf[i++];
+			if (n < need) continue;
+			need = 1;
+			if (cmd[0] == 0x0a) feed++;
+			else if (cmd[0] == 0x1b) {
+				if (n < 2) { need = 2; continue; }
+				if (cmd[1] == 0x4a) {
+					if (n < 3) { need = 3; continue; }
+					feed += cmd[2];
+				}
+			} else if (cmd[0] == 0x1d || cmd[0] == 0x1e) {
+				if (n < 3) { need = 3; continue; }
+				if (cmd[0] == 0x1d && cmd[1] == 0x49) {
+					if (n < 4) { need = 4; continue; }
+				} else if (cmd[0] == 0x1d && cmd[1] == 0x76) {
+					if (n < 8) { need = 8; continue; }
+					st = READ16_LE(cmd + 4);
+					if (!st) st = 1;
+					skip = st * READ16_LE(cmd + 6);
+					rows += READ16_LE(cmd + 6);
+					if (sim_conf.paper > 0 && rows >= (unsigned)sim_conf.paper && !nopaper) {
+						DBG_LOG("sim: out of paper\n");
+						nopaper = get_time_ms();
+					}
+				} else {
+					const char *s = NULL;
+					if (cmd[0] == 0x1e && cmd[1] == 0x47 && cmd[2] == 0x03) s = info;
+					else if (cmd[0] == 0x1d && cmd[1] == 0x67) {
+						if (cmd[2] == 0x39) s = "SIM00001";
+						else if (cmd[2] == 0x69) s = "SIM-YHK";
+						else if (cmd[2] == 0x53) {
+							s = "err:\0.";
+							if (nopaper && get_time_ms() - nopaper < 1000) s = "err:\2.";
+							else if (nopaper) sim_conf.paper = 0;
+						}
+					}
+					if (sim_conf.latency > 0) usleep(sim_conf.latency * 1000);
+					if (s && write(fd, s, s[0] == 'e' ? 6 : strlen(s) + 1) < 0) return;
+				}
+			}
+			n = 0;
+		}
+	}
+	DBG_LOG("sim: printed %lu rows, feed %lu\n", rows, feed);
+}
+
+static void sim_run(int fd, int type) {
+	if (type == SOCK_STREAM) sim_yhk_main(fd);
+	else sim_att_main(fd);
+	close(fd);
+}
+
+/* connects to the simulator server, or starts a private one */
+static int sim_connect(const char *path, int type) {
+	int sv[2];
+	if (path) {
+		struct sockaddr_un addr = { 0 };
+		int sock = socket(AF_UNIX, type, 0);
+		if (sock < 0) PERROR_EXIT(socket);
+		addr.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(addr.sun_path))
+			ERR_EXIT("socket path too long\n");
+		strcpy(addr.sun_path, path);
+		if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+			PERROR_EXIT(connect);
+		return sock;
+	}
+	if (socketpair(AF_UNIX, type, 0, sv) < 0) PERROR_EXIT(socketpair);
+	switch (fork()) {
+	case -1: PERROR_EXIT(fork);
+	case 0:
+		/* the client stops on Ctrl-C and closes the socket */
+		signal(SIGINT, SIG_IGN);
+		close(sv[0]);
+		sim_run(sv[1], type);
+		_exit(0);
+	}
+	close(sv[1]);
+	return sv[0];
+}
+
+static void sim_server(const char *mode, const char *path) {
+	struct sockaddr_un addr = { 0 };
+	int sock, type;
+	if (!strcmp(mode, "att")) type = SOCK_SEQPACKET;
+	else if (!strcmp(mode, "yhk")) type = SOCK_STREAM;
+	else ERR_EXIT("unknown simulator mode\n");
+	sock = socket(AF_UNIX, type, 0);
+	if (sock < 0) PERROR_EXIT(socket);
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+		ERR_EXIT("socket path too long\n");
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+		PERROR_EXIT(bind);
+	if (listen(sock, 64) < 0) PERROR_EXIT(listen);
+	signal(SIGCHLD, SIG_IGN);
+	for (;;) {
+		int fd = accept(sock, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			PERROR_EXIT(accept);
+		}
+		switch (fork()) {
+		case -1: PERROR_EXIT(fork);
+		case 0:
+			close(sock);
+			sim_run(fd, type);
+			_exit(0);
+		}
+		close(fd);
+	}
+}
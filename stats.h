@@ -0,0 +1,203 @@
+/*
+ * Log-linear histograms and request/response latency statistics.
+ */
+
+/* 8 sub-buckets per power of two, values up to 2^32 */
+#define HIST_SUB_BITS 3
+#define HIST_BUCKETS ((32 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+typedef struct {
+	uint64_t count, sum, max;
+	uint32_t bucket[HIST_BUCKETS];
+} hist_t;
+
+static int hist_index(uint64_t v) {
+	int shift;
+	if (v < 2 << HIST_SUB_BITS) return v;
+	if (v >> 32) return HIST_BUCKETS - 1;
+	shift = 31 - __builtin_clz((uint32_t)v) - HIST_SUB_BITS;
+	return (shift + 1) << HIST_SUB_BITS |
+			(v >> shift & ((1 << HIST_SUB_BITS) - 1));
+}
+
+/* upper bound of the bucket */
+static uint64_t hist_value(int i) {
+	int shift = (i >> HIST_SUB_BITS) - 1;
+	if (shift <= 0) return i;
+	return ((uint64_t)((1 << HIST_SUB_BITS) + (i & ((1 << HIST_SUB_BITS) - 1)) + 1) << shift) - 1;
+}
+
+static void hist_add(hist_t *h, uint64_t v) {
+	h->count++;
+	h->sum += v;
+	if (h->max < v) h->max = v;
+	h->bucket[hist_index(v)]++;
+}
+
+static uint64_t hist_quantile(const hist_t *h, double q) {
+	uint64_t n = 0, lim = q * h->count;
+	int i;
+	if (!h->count) return 0;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		if ((n += h->bucket[i]) > lim) break;
+	if (i == HIST_BUCKETS) return h->max;
+	lim = hist_value(i);
+	return lim < h->max ? lim : h->max;
+}
+
+/* link counters, each written by one thread, read by the metrics thread */
+static struct {
+	uint64_t tx_packets, tx_bytes, rx_packets, rx_bytes;
+	uint64_t requests, responses, notifications, timeouts;
+	uint64_t rx_dropped; // by the receive thread
+} bt_counters;
+
+#define COUNTER_ADD(name, n) __atomic_store_n(&bt_counters.name, \
+		bt_counters.name + (n), __ATOMIC_RELAXED)
+
+enum { STATS_ATT, STATS_TJD, STATS_MOYOUNG };
+
+#define STATS_SLOTS 64
+
+static struct {
+	int enabled, pending, nslots;
+	uint64_t start;
+	volatile sig_atomic_t dump;
+	struct {
+		int key; unsigned noreply, timeout;
+		hist_t hist;
+	} slot[STATS_SLOTS];
+} bt_stats;
+
+/* the next request is a vendor command */
+static int bt_stats_vendor = -1;
+
+static int bt_stats_slot(int key) {
+	int i;
+	for (i = 0; i < bt_stats.nslots; i++)
+		if (bt_stats.slot[i].key == key) return i;
+	if (i == STATS_SLOTS) return -1;
+	bt_stats.slot[i].key = key;
+	bt_stats.nslots++;
+	return i;
+}
+
+static void bt_stats_send(const uint8_t *buf) {
+	int i, key;
+	key = bt_stats_vendor;
+	bt_stats_vendor = -1;
+	if (key < 0) {
+		key = STATS_ATT << 8 | buf[0];
+		// commands and confirmations don't have responses
+		if (buf[0] & 0x40 || buf[0] == 0x01 || buf[0] == 0x1e) return;
+	}
+	if (bt_stats.pending >= 0 &&
+			(i = bt_stats_slot(bt_stats.pending)) >= 0)
+		bt_stats.slot[i].noreply++;
+	bt_stats.pending = key;
+	bt_stats.start = get_time_us();
+}
+
+static void bt_stats_recv(const uint8_t *buf, int len) {
+	int i, key = bt_stats.pending;
+	if (key < 0) return;
+	if (!len) {
+		if ((i = bt_stats_slot(key)) >= 0) bt_stats.slot[i].timeout++;
+		bt_stats.pending = -1;
+		return;
+	}
+	if (key >> 8 == STATS_ATT) {
+		if (buf[0] != (key & 0xff) + 1 &&
+				!(buf[0] == 0x01 && len >= 2 && buf[1] == (key & 0xff))) return;
+	} else if (buf[0] != 0x1b) return;
+	if ((i = bt_stats_slot(key)) >= 0)
+		hist_add(&bt_stats.slot[i].hist, get_time_us() - bt_stats.start);
+	bt_stats.pending = -1;
+}
+
+static void bt_stats_print(void) {
+	static const char * const name[] = { "att", "tjd", "moyoung" };
+	int i;
+	if (!bt_stats.nslots) return;
+	DBG_LOG("%-12s %7s %9s %9s %9s %9s %7s %7s\n", "latency (us)",
+			"count", "p50", "p90", "p99", "max", "noreply", "timeout");
+	for (i = 0; i < bt_stats.nslots; i++) {
+		const hist_t *h = &bt_stats.slot[i].hist;
+		int key = bt_stats.slot[i].key;
+		DBG_LOG("%-7s 0x%02x %7u %9u %9u %9u %9u %7u %7u\n",
+				name[key >> 8], key & 0xff, (unsigned)h->count,
+				(unsigned)hist_quantile(h, 0.5),
+				(unsigned)hist_quantile(h, 0.9),
+				(unsigned)hist_quantile(h, 0.99),
+				(unsigned)h->max,
+				bt_stats.slot[i].noreply, bt_stats.slot[i].timeout);
+	}
+}
+
+static void bt_stats_sig(int sig) {
+	(void)sig;
+	bt_stats.dump = 1;
+}
+
+static void bt_stats_init(void) {
+	struct sigaction sa;
+	bt_stats.enabled = 1;
+	bt_stats.pending = -1;
+	atexit(bt_stats_print);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = bt_stats_sig;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+}
+
+/* startup phase timing */
+
+#define TIMING_MARKS 16
+
+static struct {
+	int mode, n;
+	uint64_t start;
+	struct { const char *name; uint64_t t; } mark[TIMING_MARKS];
+} bt_timing;
+
+static void timing_mark(const char *name) {
+	int i = bt_timing.n;
+	if (!bt_timing.mode || i == TIMING_MARKS) return;
+	bt_timing.mark[i].name = name;
+	bt_timing.mark[i].t = get_time_us();
+	bt_timing.n = i + 1;
+}
+
+static void timing_mark_once(const char *name) {
+	int i;
+	for (i = 0; i < bt_timing.n; i++)
+		if (!strcmp(bt_timing.mark[i].name, name)) return;
+	timing_mark(name);
+}
+
+static void timing_print(void) {
+	uint64_t t = bt_timing.start;
+	int i, n = bt_timing.n;
+	if (bt_timing.mode == 2) {
+		printf("{");
+		for (i = 0; i < n; i++, t = bt_timing.mark[i - 1].t)
+			printf("\"%s\":%.3f,", bt_timing.mark[i].name,
+					(bt_timing.mark[i].t - t) / 1000.0);
+		printf("\"total\":%.3f}\n", n ?
+				(bt_timing.mark[n - 1].t - bt_timing.start) / 1000.0 : 0.0);
+		fflush(stdout);
+		return;
+	}
+	DBG_LOG("timing (ms):\n");
+	for (i = 0; i < n; i++, t = bt_timing.mark[i - 1].t)
+		DBG_LOG("  %-10s %10.3f\n", bt_timing.mark[i].name,
+				(bt_timing.mark[i].t - t) / 1000.0);
+	if (n) DBG_LOG("  %-10s %10.3f\n", "total",
+			(bt_timing.mark[n - 1].t - bt_timing.start) / 1000.0);
+}
+
+static void timing_init(int mode, uint64_t start) {
+	bt_timing.mode = mode;
+	bt_timing.start = start;
+	atexit(timing_print);
+}
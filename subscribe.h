@@ -0,0 +1,93 @@
+/*
+ * Notifications and indications of any characteristics, by UUID.
+ */
+
+#define SUB_MAX 8
+
+typedef struct {
+	bt_uuid_t uuid;
+	int decl, value, props, end;
+} gatt_char_t;
+
+struct sub_find_data {
+	int n, last; gatt_char_t *c;
+};
+
+static int sub_find_cb(void *data, const uint8_t *buf, int n) {
+	struct sub_find_data *x = data;
+	int i, h = READ16_LE(buf);
+	/* the previous characteristic ends before this declaration */
+	if (x->last >= 0) x->c[x->last].end = h - 1;
+	x->last = -1;
+	for (i = 0; i < x->n; i++) {
+		gatt_char_t *c = &x->c[i];
+		if (c->value >= 0 || c->uuid.len != n - 5 ||
+				memcmp(c->uuid.b, buf + 5, n - 5)) continue;
+		c->decl = h;
+		c->props = buf[2];
+		c->value = READ16_LE(buf + 3);
+		x->last = i;
+		break;
+	}
+	return 0;
+}
+
+static void subscribe_main(btio_t *io, int argc, char **argv) {
+	gatt_char_t chars[SUB_MAX];
+	char name[SUB_MAX][40];
+	bt_uuid_t svc;
+	struct sub_find_data data = { 0, -1, chars };
+	int i, start, end;
+
+	if (argc <= 2 || str2uuid(argv[1], &svc))
+		ERR_EXIT("bad command\n");
+	for (i = 2; i < argc; i++) {
+		gatt_char_t *c = &chars[data.n];
+		if (data.n == SUB_MAX) ERR_EXIT("too many characteristics\n");
+		if (str2uuid(argv[i], &c->uuid)) ERR_EXIT("bad uuid\n");
+		if (c->uuid.len == 2) sprintf(name[data.n], "%04x", READ16_LE(c->uuid.b));
+		else format_uuid(name[data.n], c->uuid.b, 16);
+		c->value = -1;
+		data.n++;
+	}
+
+	start = bt_find_service(io, &svc, &end);
+	for (i = 0; i < data.n; i++) chars[i].end = end;
+	enum_handles(io, start, end, ENUM_CHARS, &sub_find_cb, &data);
+	for (i = 0; i < data.n; i++) {
+		gatt_char_t *c = &chars[i];
+		int cccd;
+		if (c->value < 0) ERR_EXIT("can't find char handle\n");
+		if (!(c->props & 0x30)) ERR_EXIT("char %s can't notify\n", name[i]);
+		cccd = bt_find_char_desc(io, c->value + 1, c->end, 0x2902);
+		if (cccd < 0) ERR_EXIT("can't find char desc\n");
+		// prefer notifications, indications need confirmations
+		bt_write_req(io, cccd, c->props & 0x10 ? 1 : 2);
+		if (io->verbose >= 1)
+			DBG_LOG("%s: handle = 0x%x, cccd = 0x%x, %s\n", name[i], c->value, cccd,
+					c->props & 0x10 ? "notify" : "indicate");
+	}
+	timing_mark("cccd");
+
+	bt_catch_stop();
+	while (!bt_stop) {
+		int len = bt_recv(io), op, h;
+		uint64_t t;
+		if (len < 0) break;
+		if (len < 3) continue;
+		op = io->buf[0];
+		if (op != 0x1b && op != 0x1d) continue;
+		t = get_time_real_us();
+		if (op == 0x1d) bt_send(io, "\x1e", 1); // Handle Value Confirmation
+		timing_mark_once("first_cmd");
+		h = READ16_LE(io->buf + 1);
+		for (i = 0; i < data.n; i++)
+			if (chars[i].value == h) break;
+		if (i == data.n) continue;
+		out_begin_at("notify", NULL, t);
+		out_text("%u.%06u ", (unsigned)(t / 1000000), (unsigned)(t % 1000000));
+		out_str("uuid", "%s:", (const uint8_t*)name[i], strlen(name[i]));
+		out_hex("data", " %s\n", io->buf + 3, len - 3);
+		out_end(NULL);
+	}
+}
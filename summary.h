@@ -0,0 +1,195 @@
+/*
+ * Running statistics of Atorch samples, constant time per sample.
+ * min/max/mean/deviation (Welford), energy and charge integrated from
+ * V and I compared with the device counters, and the average current
+ * and power over rolling windows. Each window keeps the cumulative
+ * charge and energy at the end of SUM_SUB sub-intervals.
+ */
+
+#define SUM_QTY 4
+#define SUM_WINDOWS 4
+#define SUM_SUB 32
+
+typedef struct {
+	uint64_t n;
+	double min, max, mean, m2;
+} sum_var_t;
+
+typedef struct {
+	uint64_t len, sub; // us
+	uint64_t last; // last sub-interval
+	double q[SUM_SUB], e[SUM_SUB];
+	uint64_t t[SUM_SUB];
+} sum_win_t;
+
+static struct {
+	int enabled, nwin;
+	uint64_t interval, next, first, prev_time;
+	volatile sig_atomic_t dump;
+	atorch_data_t start, last;
+	double prev_pow, prev_cur;
+	double q, e; // A*s, W*s
+	sum_var_t var[SUM_QTY];
+	sum_win_t win[SUM_WINDOWS];
+} atorch_sum;
+
+static const struct {
+	const char *name, *text, *unit;
+} sum_qty[SUM_QTY] = {
+	{ "vol", "Vol", "V" }, { "cur", "Cur", "A" },
+	{ "pow", "Pow", "W" }, { "temp", "CPU", "°C" },
+};
+
+static void sum_var_add(sum_var_t *s, double v) {
+	double d;
+	if (!s->n++) s->min = s->max = v;
+	if (s->min > v) s->min = v;
+	if (s->max < v) s->max = v;
+	d = v - s->mean;
+	s->mean += d / s->n;
+	s->m2 += d * (v - s->mean);
+}
+
+static void sum_win_add(sum_win_t *w, uint64_t t, double q, double e) {
+	uint64_t k = t / w->sub;
+	int j = w->last % SUM_SUB;
+	double q0 = w->q[j], e0 = w->e[j];
+	uint64_t t0 = w->t[j];
+	if (k < w->last) return;
+	/* skipped sub-intervals keep the previous values */
+	if (w->last + SUM_SUB < k) w->last = k - SUM_SUB;
+	while (w->last < k) {
+		j = w->last++ % SUM_SUB;
+		w->q[j] = q0; w->e[j] = e0; w->t[j] = t0;
+	}
+	j = k % SUM_SUB;
+	w->q[j] = q; w->e[j] = e; w->t[j] = t;
+}
+
+/* average current and power over the window */
+static void sum_win_rate(const sum_win_t *w, double *cur, double *pow) {
+	const atorch_data_t *x = &atorch_sum.last;
+	uint64_t t0;
+	double q0, e0;
+	if (w->last + 1 >= atorch_sum.first / w->sub + SUM_SUB) {
+		int j = (w->last + 1) % SUM_SUB;
+		t0 = w->t[j]; q0 = w->q[j]; e0 = w->e[j];
+	} else {
+		t0 = atorch_sum.start.time; q0 = e0 = 0;
+	}
+	if (x->time <= t0) { *cur = *pow = 0; return; }
+	*cur = (atorch_sum.q - q0) * 1e6 / (x->time - t0);
+	*pow = (atorch_sum.e - e0) * 1e6 / (x->time - t0);
+}
+
+static void sum_add(const atorch_data_t *x) {
+	double vol = x->vol / 100.0, cur = x->cur / 100.0, pow = vol * cur;
+	int i;
+	if (!atorch_sum.var[0].n) {
+		atorch_sum.start = *x;
+		atorch_sum.first = x->time;
+		for (i = 0; i < atorch_sum.nwin; i++)
+			atorch_sum.win[i].last = x->time / atorch_sum.win[i].sub;
+	} else if (x->time > atorch_sum.prev_time) {
+		/* trapezoidal rule */
+		double dt = (x->time - atorch_sum.prev_time) * 1e-6;
+		atorch_sum.q += (atorch_sum.prev_cur + cur) * 0.5 * dt;
+		atorch_sum.e += (atorch_sum.prev_pow + pow) * 0.5 * dt;
+	}
+	atorch_sum.prev_time = x->time;
+	atorch_sum.prev_cur = cur;
+	atorch_sum.prev_pow = pow;
+	atorch_sum.last = *x;
+	sum_var_add(&atorch_sum.var[0], vol);
+	sum_var_add(&atorch_sum.var[1], cur);
+	sum_var_add(&atorch_sum.var[2], pow);
+	sum_var_add(&atorch_sum.var[3], x->temp);
+	for (i = 0; i < atorch_sum.nwin; i++)
+		sum_win_add(&atorch_sum.win[i], x->time, atorch_sum.q, atorch_sum.e);
+}
+
+/* the text format gets the integer and 3 fractional digits */
+static void sum_out(const char *key, const char *text, double v) {
+	out_fix(key, text, (long)(v * 1000 + (v < 0 ? -0.5 : 0.5)), 3);
+}
+
+static void sum_print(void) {
+	const atorch_data_t *x = &atorch_sum.last;
+	char key[32], fmt[64];
+	int i;
+	if (!atorch_sum.var[0].n) return;
+	out_begin_at("summary", "\n", x->time);
+	out_int("count", "Count:%u", atorch_sum.var[0].n);
+	sum_out("dur", " (%d.%03us)\n", (x->time - atorch_sum.start.time) * 1e-6);
+	for (i = 0; i < SUM_QTY; i++) {
+		const sum_var_t *s = &atorch_sum.var[i];
+		sprintf(key, "%s_min", sum_qty[i].name);
+		sprintf(fmt, "%s: min %%d.%%03u", sum_qty[i].text);
+		sum_out(key, fmt, s->min);
+		sprintf(key, "%s_max", sum_qty[i].name);
+		sum_out(key, ", max %d.%03u", s->max);
+		sprintf(key, "%s_mean", sum_qty[i].name);
+		sum_out(key, ", mean %d.%03u", s->mean);
+		sprintf(key, "%s_sd", sum_qty[i].name);
+		sprintf(fmt, ", sd %%d.%%03u %s\n", sum_qty[i].unit);
+		sum_out(key, fmt, s->n > 1 ? sqrt(s->m2 / (s->n - 1)) : 0);
+	}
+	sum_out("ene_int", "Ene: V*I %d.%03uWh", atorch_sum.e / 3600);
+	out_fix("ene_dev", ", device %d.%02uWh\n", x->ene - atorch_sum.start.ene, 2);
+	sum_out("cap_int", "Cap: I %d.%03umAh", atorch_sum.q / 3.6);
+	out_int("cap_dev", ", device %dmAh\n", x->cap - atorch_sum.start.cap);
+	for (i = 0; i < atorch_sum.nwin; i++) {
+		const sum_win_t *w = &atorch_sum.win[i];
+		unsigned sec = w->len / 1000000;
+		double cur, pow;
+		sum_win_rate(w, &cur, &pow);
+		sprintf(key, "cur_%us", sec);
+		sprintf(fmt, "Last %us: cur %%d.%%03uA", sec);
+		sum_out(key, fmt, cur);
+		sprintf(key, "pow_%us", sec);
+		sum_out(key, ", pow %d.%03uW\n", pow);
+	}
+	out_end(NULL);
+}
+
+static void sum_sig(int sig) {
+	(void)sig;
+	atorch_sum.dump = 1;
+}
+
+/* called for each sample */
+static void sum_update(const atorch_data_t *x) {
+	sum_add(x);
+	if (atorch_sum.dump ||
+			(atorch_sum.interval && x->time >= atorch_sum.next)) {
+		atorch_sum.dump = 0;
+		if (atorch_sum.interval)
+			atorch_sum.next = x->time + atorch_sum.interval;
+		sum_print();
+	}
+}
+
+/* "windows" is a comma separated list in seconds */
+static void sum_init(double interval, const char *windows) {
+	struct sigaction sa;
+	const char *p = windows;
+	if (atorch_sum.enabled) ERR_EXIT("summary already enabled\n");
+	atorch_sum.enabled = 1;
+	atorch_sum.interval = interval * 1e6;
+	while (*p && atorch_sum.nwin < SUM_WINDOWS) {
+		sum_win_t *w = &atorch_sum.win[atorch_sum.nwin++];
+		char *end;
+		double len = strtod(p, &end);
+		if (end == p || len <= 0) ERR_EXIT("bad window list\n");
+		w->len = len * 1e6;
+		w->sub = w->len / SUM_SUB;
+		if (!w->sub) w->sub = 1;
+		p = *end == ',' ? end + 1 : end;
+	}
+	atexit(sum_print);
+	bt_catch_stop();
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sum_sig;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR2, &sa, NULL);
+}
@@ -8,13 +8,7 @@
 static int tjd_handle[2] = { 0x1b, 0x1e };
 
 static int tjd_crc8(const uint8_t *s, unsigned n) {
-	unsigned j, c = 0;
-	while (n--) {
-		c ^= *s++;
-		for (j = 0; j < 8; j++)
-			c = c >> 1 ^ ((0u - (c & 1)) & 0x8c);
-	}
-	return c;
+	return crc8_tab(s, n, 0);
 }
 
 static void tjd_cmd(btio_t *io, const uint8_t *src, unsigned len, int flags) {
@@ -28,23 +22,41 @@ static void tjd_cmd(btio_t *io, const uint8_t *src, unsigned len, int flags) {
 	if (flags & 2) {
 		io->buf[pos] = tjd_crc8(io->buf + 3, pos - 3);
 		pos++;
+		bt_stats_vendor = STATS_TJD << 8 | src[0];
 	}
 	bt_send(io, NULL, pos);
 }
 
+enum {
+	TJD_ERR_RESPONSE = -1, TJD_ERR_HANDLE = -2, TJD_ERR_MAGIC = -3,
+	TJD_ERR_LENGTH = -4, TJD_ERR_CHECKSUM = -5
+};
+
+/* validates a notification, returns the frame length or an error */
+static int tjd_check(const uint8_t *buf, int len) {
+	if (buf[0] != 0x1b || len < 6) return TJD_ERR_RESPONSE;
+	if (READ16_LE(buf + 1) != tjd_handle[1]) return TJD_ERR_HANDLE;
+	len -= 3;
+	if (buf[3] != 0x5a) return TJD_ERR_MAGIC;
+	while (buf[4] < len && !buf[3 + len - 1]) len--;
+	if (buf[4] != len) return TJD_ERR_LENGTH;
+	if (buf[3 + len - 1] != tjd_crc8(buf + 3, len - 1))
+		return TJD_ERR_CHECKSUM;
+	return len;
+}
+
 static int tjd_recv(btio_t *io) {
 	int len = bt_recv(io);
 	if (!len) return 0;
-	if (io->buf[0] != 0x1b || len < 6)
-		ERR_EXIT("unexpected response\n");
-	if (READ16_LE(io->buf + 1) != tjd_handle[1]) 
-		ERR_EXIT("unexpected handle\n");
-	len -= 3;
-	if (io->buf[3] != 0x5a) ERR_EXIT("wrong magic\n");
-	while (io->buf[4] < len && !io->buf[3 + len - 1]) len--;
-	if (io->buf[4] != len) ERR_EXIT("wrong length\n");
-	if (io->buf[3 + len - 1] != tjd_crc8(io->buf + 3, len - 1)) 
-		ERR_EXIT("wrong checksum\n");
+	len = tjd_check(io->buf, len);
+	switch (len) {
+	case TJD_ERR_RESPONSE: ERR_EXIT("unexpected response\n");
+	case TJD_ERR_HANDLE: ERR_EXIT("unexpected handle\n");
+	case TJD_ERR_MAGIC: ERR_EXIT("wrong magic\n");
+	case TJD_ERR_LENGTH: ERR_EXIT("wrong length\n");
+	case TJD_ERR_CHECKSUM: ERR_EXIT("wrong checksum\n");
+	}
+	timing_mark_once("first_cmd");
 	return len;
 }
 
@@ -124,24 +136,26 @@ static void tjd_main(btio_t *io, int argc, char **argv) {
 			tjd_cmd(io, cmd1, sizeof(cmd1), 3);
 			len = tjd_recv(io);
 			if (len == 0x14 && io->buf[5] == 0x00) {
-				DBG_LOG("DevInfo:\n");
-				DBG_LOG("Support = 0x%04x\n", READ16_LE(io->buf + 6));
-				DBG_LOG("DevTypeReserve = %04X\n", READ16_BE(io->buf + 8));
-				DBG_LOG("Type = %08X\n", READ32_BE(io->buf + 10));
-				DBG_LOG("HWVer = %u.%u\n", io->buf[14], io->buf[15]);
-				DBG_LOG("SWVer = %u.%u\n", io->buf[16], io->buf[17]);
-				DBG_LOG("Vendor = %08X\n", READ32_BE(io->buf + 18));
-				DBG_LOG("\n");
+				out_begin("devinfo", "DevInfo:\n");
+				out_int("support", "Support = 0x%04x\n", READ16_LE(io->buf + 6));
+				out_int("dev_type_reserve", "DevTypeReserve = %04X\n", READ16_BE(io->buf + 8));
+				out_int("dev_type", "Type = %08X\n", (uint32_t)READ32_BE(io->buf + 10));
+				out_int("hw_major", "HWVer = %u", io->buf[14]);
+				out_int("hw_minor", ".%u\n", io->buf[15]);
+				out_int("sw_major", "SWVer = %u", io->buf[16]);
+				out_int("sw_minor", ".%u\n", io->buf[17]);
+				out_int("vendor", "Vendor = %08X\n", (uint32_t)READ32_BE(io->buf + 18));
+				out_end("\n");
 			}
 			tjd_cmd(io, cmd2, sizeof(cmd2), 3);
 			len = tjd_recv(io);
 			if ((len == 11 || len == 12) && io->buf[5] == 0x39) {
-				DBG_LOG("DialPara:\n");
-				DBG_LOG("Type = %u\n", io->buf[6]);
-				DBG_LOG("Width = %u\n", READ16_BE(io->buf + 7));
-				DBG_LOG("Height = %u\n", READ16_BE(io->buf + 9));
-				DBG_LOG("Size = %u\n", READ16_BE(io->buf + 11));
-				DBG_LOG("\n");
+				out_begin("dialpara", "DialPara:\n");
+				out_int("dial_type", "Type = %u\n", io->buf[6]);
+				out_int("width", "Width = %u\n", READ16_BE(io->buf + 7));
+				out_int("height", "Height = %u\n", READ16_BE(io->buf + 9));
+				out_int("size", "Size = %u\n", READ16_BE(io->buf + 11));
+				out_end("\n");
 			}
 			// don't have devices that respond to this
 			if (0) {
@@ -156,8 +170,11 @@ static void tjd_main(btio_t *io, int argc, char **argv) {
 			int len;
 			tjd_cmd(io, cmd, sizeof(cmd), 3);
 			len = tjd_recv(io);
-			if (len == 5 && io->buf[5] == 0x03)
-				DBG_LOG("BatteryLevel = %u%%\n", io->buf[6]);
+			if (len == 5 && io->buf[5] == 0x03) {
+				out_begin("battery", NULL);
+				out_int("level", "BatteryLevel = %u%%\n", io->buf[6]);
+				out_end(NULL);
+			}
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "finddev")) {
@@ -199,13 +216,14 @@ static void tjd_main(btio_t *io, int argc, char **argv) {
 			tjd_cmd(io, cmd, sizeof(cmd), 3);
 			len = tjd_recv(io);
 			if (len == 11 && io->buf[5] == 0x2e && io->buf[6] == 0x00) {
-				DBG_LOG("DialInfoGet:\n");
-				DBG_LOG("TimePosition = %u\n", io->buf[7]); // 0 = top, 1 = bottom
-				DBG_LOG("TimeTop = %u\n", io->buf[8]);
-				DBG_LOG("TimeBottom = %u\n", io->buf[9]);
-				DBG_LOG("ContentColor = %u\n", io->buf[10]); // 0..8
-				DBG_LOG("DialSelect = %u\n", io->buf[11]);
-				DBG_LOG("DefaultBG = %u\n", io->buf[12]);
+				out_begin("dialinfo", "DialInfoGet:\n");
+				out_int("time_position", "TimePosition = %u\n", io->buf[7]); // 0 = top, 1 = bottom
+				out_int("time_top", "TimeTop = %u\n", io->buf[8]);
+				out_int("time_bottom", "TimeBottom = %u\n", io->buf[9]);
+				out_int("content_color", "ContentColor = %u\n", io->buf[10]); // 0..8
+				out_int("dial_select", "DialSelect = %u\n", io->buf[11]);
+				out_int("default_bg", "DefaultBG = %u\n", io->buf[12]);
+				out_end(NULL);
 			}
 			argc -= 1; argv += 1;
 
@@ -233,11 +251,13 @@ static void tjd_main(btio_t *io, int argc, char **argv) {
 			tjd_cmd(io, cmd, sizeof(cmd), 3);
 			len = tjd_recv(io);
 			if (len == 8 && io->buf[5] == 0x02 && io->buf[6] == 0x00) {
-				DBG_LOG("LangGet:\n");
+				out_begin("langget", "LangGet:\n");
 				// DBG_LOG("Language = %u (unused)\n", io->buf[7]);
-				DBG_LOG("TimeFormat = %u (%s)\n", io->buf[8], io->buf[8] ? "12" : "24");
-				DBG_LOG("UnitSystem = %u (%s)\n", io->buf[9], io->buf[9] ? "Imperial" : "Metric");
-				DBG_LOG("\n");
+				out_int("time_format", "TimeFormat = %u", io->buf[8]);
+				out_text(" (%s)\n", io->buf[8] ? "12" : "24");
+				out_int("unit_system", "UnitSystem = %u", io->buf[9]);
+				out_text(" (%s)\n", io->buf[9] ? "Imperial" : "Metric");
+				out_end("\n");
 			}
 			argc -= 1; argv += 1;
 
@@ -248,9 +268,9 @@ static void tjd_main(btio_t *io, int argc, char **argv) {
 			len = tjd_recv(io);
 			if (len == 7 && io->buf[5] == 0x07 && io->buf[6] == 0x00) {
 				int mask = READ16_BE(io->buf + 7);
-				DBG_LOG("UIGet:\n");
-				DBG_LOG("Mask = 0x%04x\n", mask);
-				DBG_LOG("\n");
+				out_begin("uiget", "UIGet:\n");
+				out_int("mask", "Mask = 0x%04x\n", mask);
+				out_end("\n");
 			}
 			argc -= 1; argv += 1;
 
@@ -271,9 +291,9 @@ static void tjd_main(btio_t *io, int argc, char **argv) {
 			len = tjd_recv(io);
 			if (len == 7 && io->buf[5] == 0x08 && io->buf[6] == 0x00) {
 				int mask = READ16_BE(io->buf + 7);
-				DBG_LOG("FuncGet:\n");
-				DBG_LOG("Mask = 0x%04x\n", mask);
-				DBG_LOG("\n");
+				out_begin("funcget", "FuncGet:\n");
+				out_int("mask", "Mask = 0x%04x\n", mask);
+				out_end("\n");
 			}
 			argc -= 1; argv += 1;
 
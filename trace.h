@@ -0,0 +1,130 @@
+/*
+ * Trace logger for "verbose 2".
+ * Packets are copied into a lock-free single producer ring and
+ * formatted by a background thread, so tracing doesn't stall the I/O.
+ * When the ring is full, records are dropped and counted.
+ */
+
+enum { TRACE_SEND, TRACE_RECV };
+
+#define TRACE_SLOTS 1024
+#define TRACE_OUTSIZE 16384
+
+static struct {
+	unsigned head, tail, drops;
+	int state, stop;
+	uint64_t start;
+	pthread_t thread;
+	struct {
+		uint64_t time;
+		int dir, len, n; // n bytes of len are kept
+		uint8_t data[IO_BUFSIZE];
+	} slot[TRACE_SLOTS];
+	char out[TRACE_OUTSIZE];
+} bt_trace;
+
+static void trace_write(const char *buf, size_t len) {
+	while (len) {
+		ssize_t ret = write(STDERR_FILENO, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		buf += ret; len -= ret;
+	}
+}
+
+/* dumps the first "n" of "len" bytes */
+static int trace_format(char *d, uint64_t time, int dir, const uint8_t *buf, int len, int n) {
+	static const char * const name[] = { "send", "recv" };
+	char *p = d;
+	int i, k;
+	time -= bt_trace.start;
+	p += sprintf(p, "[%u.%06u] %s (%d", (unsigned)(time / 1000000),
+			(unsigned)(time % 1000000), name[dir], len);
+	if (n < len) p += sprintf(p, ", first %d shown", n);
+	p += sprintf(p, "):\n");
+	for (i = 0; i < n; i += 16) {
+		k = n - i;
+		if (k > 16) k = 16;
+		p += format_mem_line(p, buf + i, k);
+	}
+	return p - d;
+}
+
+static void *trace_thread(void *arg) {
+	unsigned head, tail = bt_trace.tail;
+	int pos = 0;
+	(void)arg;
+	for (;;) {
+		head = __atomic_load_n(&bt_trace.head, __ATOMIC_ACQUIRE);
+		if (head == tail) {
+			if (pos) trace_write(bt_trace.out, pos), pos = 0;
+			if (__atomic_load_n(&bt_trace.stop, __ATOMIC_ACQUIRE)) {
+				if (head == __atomic_load_n(&bt_trace.head, __ATOMIC_ACQUIRE))
+					break;
+				continue;
+			}
+			usleep(1000);
+			continue;
+		}
+		do {
+			unsigned i = tail & (TRACE_SLOTS - 1);
+			if (pos > TRACE_OUTSIZE - 96 - MEM_LINE_MAX * (IO_BUFSIZE / 16))
+				trace_write(bt_trace.out, pos), pos = 0;
+			pos += trace_format(bt_trace.out + pos, bt_trace.slot[i].time,
+					bt_trace.slot[i].dir, bt_trace.slot[i].data,
+					bt_trace.slot[i].len, bt_trace.slot[i].n);
+			tail++;
+			__atomic_store_n(&bt_trace.tail, tail, __ATOMIC_RELEASE);
+		} while (tail != head);
+	}
+	if (pos) trace_write(bt_trace.out, pos);
+	return NULL;
+}
+
+static void trace_stop(void) {
+	if (bt_trace.state != 1) return;
+	__atomic_store_n(&bt_trace.stop, 1, __ATOMIC_RELEASE);
+	pthread_join(bt_trace.thread, NULL);
+	bt_trace.state = 2;
+	if (bt_trace.drops)
+		DBG_LOG("trace: %u records dropped\n", bt_trace.drops);
+}
+
+/* traces a packet of "len" bytes, dumping at most the first "n" */
+static void trace_mem_n(int dir, const uint8_t *buf, int len, int n) {
+	unsigned head, i;
+	if (n > len) n = len;
+	if (n > IO_BUFSIZE) n = IO_BUFSIZE;
+	if (!bt_trace.state) {
+		bt_trace.start = get_time_us();
+		bt_trace.state = 2;
+		if (!pthread_create(&bt_trace.thread, NULL, trace_thread, NULL)) {
+			bt_trace.state = 1;
+			atexit(trace_stop);
+		}
+	}
+	if (bt_trace.state != 1) {
+		/* synchronous fallback */
+		char tmp[96 + MEM_LINE_MAX * (IO_BUFSIZE / 16)];
+		trace_write(tmp, trace_format(tmp, get_time_us(), dir, buf, len, n));
+		return;
+	}
+	head = bt_trace.head;
+	if (head - __atomic_load_n(&bt_trace.tail, __ATOMIC_ACQUIRE) == TRACE_SLOTS) {
+		bt_trace.drops++;
+		return;
+	}
+	i = head & (TRACE_SLOTS - 1);
+	bt_trace.slot[i].time = get_time_us();
+	bt_trace.slot[i].dir = dir;
+	bt_trace.slot[i].len = len;
+	bt_trace.slot[i].n = n;
+	memcpy(bt_trace.slot[i].data, buf, n);
+	__atomic_store_n(&bt_trace.head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void trace_mem(int dir, const uint8_t *buf, int len) {
+	trace_mem_n(dir, buf, len, len);
+}
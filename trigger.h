@@ -0,0 +1,141 @@
+/*
+ * Threshold triggers on Atorch samples, checked on every sample.
+ * Rule: FIELD OP VALUE[@MS], the condition must hold for MS milliseconds,
+ * the action fires once and again only after the condition clears.
+ * Actions: exit:CODE, mark:TEXT (a record in the output), exec:COMMAND
+ * (run by /bin/sh without waiting, $1 is the rule and $2 the value).
+ */
+
+#define TRIG_MAX 8
+
+enum { TRIG_EXIT, TRIG_MARK, TRIG_EXEC };
+
+typedef struct {
+	const char *rule, *arg;
+	int field, op, action, fired;
+	double value; // in the sample units
+	uint64_t hold, since; // us
+} trig_t;
+
+static struct {
+	int n;
+	trig_t t[TRIG_MAX];
+} atorch_trig;
+
+static const struct {
+	const char *name; double scale;
+} trig_field[] = {
+	{ "vol", 100 }, { "cur", 100 }, { "pow", 10000 },
+	{ "cap", 1 }, { "ene", 100 }, { "temp", 1 },
+	{ "dm", 100 }, { "dp", 100 },
+};
+
+static double trig_get(const atorch_data_t *x, int field) {
+	switch (field) {
+	case 0: return x->vol;
+	case 1: return x->cur;
+	case 2: return (double)x->vol * x->cur;
+	case 3: return x->cap;
+	case 4: return x->ene;
+	case 5: return x->temp;
+	case 6: return x->dm;
+	default: return x->dp;
+	}
+}
+
+static void trig_add(const char *rule, const char *action) {
+	trig_t *t;
+	const char *p = rule;
+	char *end;
+	int i, n;
+	if (atorch_trig.n == TRIG_MAX) ERR_EXIT("too many triggers\n");
+	t = &atorch_trig.t[atorch_trig.n];
+	memset(t, 0, sizeof(*t));
+	t->rule = rule;
+	for (i = 0; i < (int)(sizeof(trig_field) / sizeof(*trig_field)); i++) {
+		n = strlen(trig_field[i].name);
+		if (!strncmp(p, trig_field[i].name, n) && strchr("<>", p[n])) break;
+	}
+	if (i == (int)(sizeof(trig_field) / sizeof(*trig_field)))
+		ERR_EXIT("bad trigger rule\n");
+	t->field = i;
+	p += n;
+	t->op = *p++ == '<' ? 0 : 2;
+	if (*p == '=') t->op++, p++;
+	t->value = strtod(p, &end) * trig_field[i].scale;
+	if (end == p) ERR_EXIT("bad trigger rule\n");
+	p = end;
+	if (*p == '@') {
+		t->hold = strtod(p + 1, &end) * 1000;
+		if (end == p + 1) ERR_EXIT("bad trigger rule\n");
+		p = end;
+	}
+	if (*p) ERR_EXIT("bad trigger rule\n");
+
+	if (!strncmp(action, "exit:", 5)) t->action = TRIG_EXIT;
+	else if (!strncmp(action, "mark:", 5)) t->action = TRIG_MARK;
+	else if (!strncmp(action, "exec:", 5)) t->action = TRIG_EXEC;
+	else ERR_EXIT("bad trigger action\n");
+	t->arg = action + 5;
+	atorch_trig.n++;
+}
+
+static void trig_exec(const trig_t *t, double v) {
+	char buf[32];
+	pid_t pid;
+	snprintf(buf, sizeof(buf), "%g", v / trig_field[t->field].scale);
+	/* the intermediate child exits at once, the command is not waited for */
+	switch (pid = fork()) {
+	case -1: DBG_LOG("fork failed\n"); return;
+	case 0:
+		if (fork() == 0) {
+			execl("/bin/sh", "sh", "-c", t->arg, "sh", t->rule, buf, (char*)NULL);
+			_exit(127);
+		}
+		_exit(0);
+	}
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR);
+}
+
+static void trig_fire(trig_t *t, const atorch_data_t *x, double v) {
+	switch (t->action) {
+	case TRIG_EXIT:
+		out_begin_at("trigger", NULL, x->time);
+		out_str("rule", "trigger %s\n", (const uint8_t*)t->rule, strlen(t->rule));
+		out_end(NULL);
+		exit(atoi(t->arg));
+	case TRIG_MARK:
+		out_begin_at("trigger", NULL, x->time);
+		out_str("rule", "trigger %s: ", (const uint8_t*)t->rule, strlen(t->rule));
+		out_str("mark", "%s\n", (const uint8_t*)t->arg, strlen(t->arg));
+		out_end(NULL);
+		break;
+	default:
+		trig_exec(t, v);
+	}
+}
+
+static void trig_check(const atorch_data_t *x) {
+	int i;
+	for (i = 0; i < atorch_trig.n; i++) {
+		trig_t *t = &atorch_trig.t[i];
+		double v = trig_get(x, t->field);
+		int cond;
+		switch (t->op) {
+		case 0: cond = v < t->value; break;
+		case 1: cond = v <= t->value; break;
+		case 2: cond = v > t->value; break;
+		default: cond = v >= t->value;
+		}
+		if (!cond) {
+			t->since = 0;
+			t->fired = 0;
+			continue;
+		}
+		if (!t->since) t->since = x->time;
+		if (!t->fired && x->time - t->since >= t->hold) {
+			t->fired = 1;
+			trig_fire(t, x, v);
+		}
+	}
+}
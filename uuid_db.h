@@ -0,0 +1,136 @@
+/*
+ * UUID names: the built-in SIG list (by binary search over the sorted
+ * 16-bit values), built-in vendor 128-bit UUIDs, and an optional user
+ * database that takes precedence. The database is a text file of
+ * "UUID name" lines ('#' starts a comment), mapped into memory and
+ * indexed once, the names stay in the mapping.
+ */
+
+typedef struct {
+	uint8_t key[16]; // as on the air, 16-bit UUIDs expanded
+	int len; const char *name;
+} uuid_db_entry_t;
+
+static struct {
+	int n;
+	uuid_db_entry_t *e;
+} uuid_db;
+
+static const uint8_t uuid_base[16] = {
+	0xfb,0x34,0x9b,0x5f,0x80,0x00,0x00,0x80, 0x00,0x10,0x00,0x00, 0,0,0,0 };
+
+static void uuid_expand(uint8_t *dst, const uint8_t *buf, int len) {
+	if (len == 16) {
+		memcpy(dst, buf, 16);
+		return;
+	}
+	memcpy(dst, uuid_base, 16);
+	dst[12] = buf[0]; dst[13] = buf[1];
+}
+
+static int uuid_db_cmp(const void *a, const void *b) {
+	return memcmp(a, b, 16);
+}
+
+static void uuid_db_load(const char *fn) {
+	struct stat st;
+	const char *p, *end;
+	char *map;
+	int fd, size = 0;
+	if ((fd = open(fn, O_RDONLY)) < 0) PERROR_EXIT(open);
+	if (fstat(fd, &st) < 0) PERROR_EXIT(fstat);
+	if (!st.st_size) ERR_EXIT("empty UUID database\n");
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) PERROR_EXIT(mmap);
+	close(fd);
+	for (p = map, end = map + st.st_size; p < end; ) {
+		const char *line = p, *q, *eol = memchr(p, '\n', end - p);
+		uuid_db_entry_t *e;
+		bt_uuid_t uuid;
+		char tmp[40];
+		int n;
+		if (!eol) eol = end;
+		p = eol + 1;
+		while (line < eol && (*line == ' ' || *line == '\t')) line++;
+		if (line == eol || *line == '#' || *line == '\r') continue;
+		for (q = line; q < eol && *q != ' ' && *q != '\t'; q++);
+		n = q - line;
+		if (n >= (int)sizeof(tmp)) ERR_EXIT("bad UUID in database\n");
+		memcpy(tmp, line, n);
+		tmp[n] = 0;
+		if (str2uuid(tmp, &uuid)) ERR_EXIT("bad UUID in database\n");
+		while (q < eol && (*q == ' ' || *q == '\t')) q++;
+		while (eol > q && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r')) eol--;
+		if (uuid_db.n == size) {
+			size = size ? size * 2 : 256;
+			uuid_db.e = realloc(uuid_db.e, size * sizeof(*e));
+			if (!uuid_db.e) ERR_EXIT("realloc failed\n");
+		}
+		e = &uuid_db.e[uuid_db.n++];
+		uuid_expand(e->key, uuid.b, uuid.len);
+		e->name = q;
+		e->len = eol - q;
+	}
+	qsort(uuid_db.e, uuid_db.n, sizeof(*uuid_db.e), uuid_db_cmp);
+}
+
+static int uuid_info_cmp(const void *a, const void *b) {
+	return *(const int*)a - *(const int*)b;
+}
+
+static int uuid_vendor_cmp(const void *a, const void *b) {
+	return strcmp(a, *(const char* const*)b);
+}
+
+/* "buf" is a UUID as on the air, returns NULL if unknown */
+static const char *uuid_name(const uint8_t *buf, int len, int *name_len) {
+	uint8_t key[16];
+	char str[40];
+	const char *s = NULL;
+	int uuid = -1;
+	uuid_expand(key, buf, len);
+	if (uuid_db.n) {
+		const uuid_db_entry_t *e = bsearch(key, uuid_db.e,
+				uuid_db.n, sizeof(*e), uuid_db_cmp);
+		if (e) {
+			*name_len = e->len;
+			return e->name;
+		}
+	}
+	if (len == 2) uuid = READ16_LE(buf);
+	else if (!memcmp(key, uuid_base, 12) && !key[14] && !key[15])
+		uuid = READ16_LE(key + 12);
+	if (uuid >= 0) {
+		const void *e = bsearch(&uuid, gatt_uuid_info,
+				sizeof(gatt_uuid_info) / sizeof(*gatt_uuid_info) - 1,
+				sizeof(*gatt_uuid_info), uuid_info_cmp);
+		if (e) s = gatt_uuid_info[((const char*)e - (const char*)gatt_uuid_info) /
+				sizeof(*gatt_uuid_info)].info;
+	} else {
+		const void *e;
+		format_uuid(str, key, 16);
+		e = bsearch(str, gatt_uuid_vendor,
+				sizeof(gatt_uuid_vendor) / sizeof(*gatt_uuid_vendor),
+				sizeof(*gatt_uuid_vendor), uuid_vendor_cmp);
+		if (e) s = gatt_uuid_vendor[((const char*)e - (const char*)gatt_uuid_vendor) /
+				sizeof(*gatt_uuid_vendor)].info;
+	}
+	if (s) *name_len = strlen(s);
+	return s;
+}
+
+/* the built-in lists must be strictly sorted for bsearch */
+static int uuid_test(void) {
+	unsigned i, n = sizeof(gatt_uuid_info) / sizeof(*gatt_uuid_info) - 1;
+	int err = 0, fail;
+	for (i = 1; i < n; i++)
+		if (gatt_uuid_info[i - 1].uuid >= gatt_uuid_info[i].uuid) err++;
+	printf("%-10s %s\n", "uuid_info", err ? "FAILED" : "ok");
+	fail = err;
+	err = 0;
+	n = sizeof(gatt_uuid_vendor) / sizeof(*gatt_uuid_vendor);
+	for (i = 1; i < n; i++)
+		if (strcmp(gatt_uuid_vendor[i - 1].uuid, gatt_uuid_vendor[i].uuid) >= 0) err++;
+	printf("%-10s %s\n", "uuid_vend", err ? "FAILED" : "ok");
+	return fail | err;
+}
@@ -1,3 +1,4 @@
+/* a subset of the SIG assigned numbers, sorted by UUID (--uuid-db for the rest) */
 
 static const struct {
 	int uuid; const char *info;
@@ -47,6 +48,22 @@ X(0x1826, "Fitness Machine")
 X(0x1827, "Mesh Provisioning Service")
 X(0x1828, "Mesh Proxy Service")
 X(0x1829, "Reconnection Configuration")
+X(0x1843, "Audio Input Control")
+X(0x1844, "Volume Control")
+X(0x1845, "Volume Offset Control")
+X(0x1846, "Coordinated Set Identification")
+X(0x1848, "Media Control")
+X(0x1849, "Generic Media Control")
+X(0x184b, "Telephone Bearer")
+X(0x184c, "Generic Telephone Bearer")
+X(0x184d, "Microphone Control")
+X(0x184e, "Audio Stream Control")
+X(0x184f, "Broadcast Audio Scan")
+X(0x1850, "Published Audio Capabilities")
+X(0x1851, "Basic Audio Announcement")
+X(0x1852, "Broadcast Audio Announcement")
+X(0x1853, "Common Audio")
+X(0x1854, "Hearing Access")
 
 /* declarations */
 X(0x2800, "GATT Primary Service Declaration")
@@ -290,6 +307,36 @@ X(0x2b1d, "RC Feature")
 X(0x2b1e, "RC Settings")
 X(0x2b1f, "Reconnection Configuration Control Point")
 
+/* member services */
+X(0xfd6f, "Exposure Notification")
+X(0xfe59, "Nordic Secure DFU")
+X(0xfeaa, "Google Eddystone")
+
 #undef X
 { 0, NULL } };
 
+/* sorted by the string */
+static const struct {
+	const char *uuid, *info;
+} gatt_uuid_vendor[] = {
+	{ "00001523-1212-efde-1523-785feabcd123", "Nordic LED Button Service" },
+	{ "00001524-1212-efde-1523-785feabcd123", "Nordic LBS Button" },
+	{ "00001525-1212-efde-1523-785feabcd123", "Nordic LBS LED" },
+	{ "00001530-1212-efde-1523-785feabcd123", "Nordic Legacy DFU Service" },
+	{ "00001531-1212-efde-1523-785feabcd123", "Nordic Legacy DFU Control Point" },
+	{ "00001532-1212-efde-1523-785feabcd123", "Nordic Legacy DFU Packet" },
+	{ "00001534-1212-efde-1523-785feabcd123", "Nordic Legacy DFU Version" },
+	{ "49535343-1e4d-4bd9-ba61-23c647249616", "Microchip Transparent UART TX" },
+	{ "49535343-8841-43f4-a8d4-ecbe34729bb3", "Microchip Transparent UART RX" },
+	{ "49535343-fe7d-4ae5-8fa9-9fafd205e455", "Microchip Transparent UART Service" },
+	{ "6e400001-b5a3-f393-e0a9-e50e24dcca9e", "Nordic UART Service" },
+	{ "6e400002-b5a3-f393-e0a9-e50e24dcca9e", "Nordic UART RX" },
+	{ "6e400003-b5a3-f393-e0a9-e50e24dcca9e", "Nordic UART TX" },
+	{ "7905f431-b5ce-4e99-a40f-4b1e122d00d0", "Apple Notification Center Service" },
+	{ "89d3502b-0f36-433a-8ef4-c502ad55f8dc", "Apple Media Service" },
+	{ "8ec90001-f315-4f60-9fb8-838830daea50", "Nordic Secure DFU Control Point" },
+	{ "8ec90002-f315-4f60-9fb8-838830daea50", "Nordic Secure DFU Packet" },
+	{ "8ec90003-f315-4f60-9fb8-838830daea50", "Nordic Buttonless DFU" },
+	{ "d0611e78-bbb4-4591-a5f8-487910ae4366", "Apple Continuity Service" },
+};
+
@@ -12,33 +12,244 @@ static int yhk_print_readstr(btio_t *io, uint8_t *buf, int n) {
 	return i;
 }
 
-static uint8_t* yhk_print_read_pbm(const char *fn, unsigned width, unsigned *height) {
-	FILE *f = NULL; uint8_t *data = NULL;
-	do {
-		unsigned t, w, h;
-		if (!fn || !(f = fopen(fn, "rb"))) break;
-		if (fgetc(f) != 'P') break;
-		if (fgetc(f) != '4') break;
-		if ((w = pnm_next(f)) != width)
-			ERR_EXIT("image width must be %u\n", width);
-		if (((h = pnm_next(f)) - 1) >> 14) break;
-		w = (w + 7) >> 3;
-		t = w * h;
-		if (!(data = malloc(t))) break;
-		if (fread(data, 1, t, f) != t) goto err;
-		*height = h;
-		goto ok;
-	} while (0);
-err:
-	if (data) { free(data); data = NULL; }
-ok:
-	if (f) fclose(f);
-	return data;
+#define YHK_CHUNK_MIN 0x400
+#define YHK_CHUNK_MAX 0x10000
+#define YHK_IOV 16
+#define YHK_BAND 256
+#define YHK_POLL_US 10000
+#define YHK_BLANK_MIN 4
+
+/* writes all the buffers, continuing after partial writes */
+static void yhk_writev(btio_t *io, struct iovec *iov, int n) {
+	int i;
+	if (io->verbose >= 2)
+		for (i = 0; i < n; i++)
+			trace_mem_n(TRACE_SEND, iov[i].iov_base, iov[i].iov_len, 64);
+	while (n) {
+		ssize_t ret = writev(io->sock, iov, n);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			PERROR_EXIT(writev);
+		}
+		COUNTER_ADD(tx_packets, 1);
+		COUNTER_ADD(tx_bytes, ret);
+		for (; n && (size_t)ret >= iov->iov_len; n--, iov++)
+			ret -= iov->iov_len;
+		if (n) {
+			iov->iov_base = (char*)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		}
+	}
+}
+
+typedef struct {
+	struct iovec iov[YHK_IOV];
+	uint8_t cmd[YHK_IOV][8]; // commands for the same iov entries
+	int n; size_t size, limit;
+} yhk_out_t;
+
+static void yhk_out_flush(btio_t *io, yhk_out_t *o) {
+	if (o->n) yhk_writev(io, o->iov, o->n);
+	o->n = 0; o->size = 0;
+}
+
+/* "cmd" set if the data is a command to copy */
+static void yhk_out_add(btio_t *io, yhk_out_t *o, const void *p, size_t len, int cmd) {
+	if (o->n == YHK_IOV) yhk_out_flush(io, o);
+	if (cmd) p = memcpy(o->cmd[o->n], p, len);
+	o->iov[o->n].iov_base = (void*)p;
+	o->iov[o->n++].iov_len = len;
+	if ((o->size += len) >= o->limit) yhk_out_flush(io, o);
+}
+
+/* number of all-zero rows from "p", up to "n", word-wise */
+static unsigned yhk_blank_rows(const uint8_t *p, unsigned st, unsigned n) {
+	unsigned y, i;
+	for (y = 0; y < n; y++, p += st) {
+		uint64_t a = 0, w;
+		for (i = 0; i + 8 <= st; i += 8) {
+			memcpy(&w, p + i, 8);
+			a |= w;
+		}
+		for (; i < st; i++) a |= p[i];
+		if (a) break;
+	}
+	return y;
+}
+
+/*
+ * Sends the rows in writes of about half the socket buffer. Runs of
+ * at least YHK_BLANK_MIN blank rows are sent as paper feed (1b 4a n),
+ * the rows between them with raster commands. The trailer goes with
+ * the last rows. Returns the number of blank rows skipped.
+ */
+static unsigned yhk_send_raster(btio_t *io, const uint8_t *image,
+		unsigned st, unsigned height, const uint8_t *tail, int tail_len) {
+	uint8_t cmd[] = { 0x1d,0x76,0x30,0, 0,0,0,0 };
+	yhk_out_t o;
+	unsigned y = 0, j, k, rows, blank = 0;
+	int sndbuf = 0;
+	socklen_t optlen = sizeof(sndbuf);
+
+	if (getsockopt(io->sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) < 0)
+		sndbuf = 0;
+	sndbuf /= 2;
+	if (sndbuf < YHK_CHUNK_MIN) sndbuf = YHK_CHUNK_MIN;
+	if (sndbuf > YHK_CHUNK_MAX) sndbuf = YHK_CHUNK_MAX;
+	rows = sndbuf / st;
+	if (!rows) rows = 1;
+	o.n = 0; o.size = 0; o.limit = sndbuf;
+
+	WRITE16_LE(cmd + 4, st);
+	while (y < height) {
+		k = yhk_blank_rows(image + (size_t)y * st, st, height - y);
+		if (k >= YHK_BLANK_MIN) {
+			blank += k;
+			y += k;
+			while (k) {
+				uint8_t feed[3] = { 0x1b,0x4a,0 };
+				feed[2] = k < 255 ? k : 255;
+				k -= feed[2];
+				yhk_out_add(io, &o, feed, 3, 1);
+			}
+			continue;
+		}
+		/* up to the next long blank run */
+		for (j = y + (k ? k : 1); j < height; j += k ? k : 1) {
+			k = yhk_blank_rows(image + (size_t)j * st, st, height - j);
+			if (k >= YHK_BLANK_MIN) break;
+		}
+		WRITE16_LE(cmd + 6, j - y);
+		yhk_out_add(io, &o, cmd, sizeof(cmd), 1);
+		for (; y < j; y += k) {
+			k = j - y < rows ? j - y : rows;
+			yhk_out_add(io, &o, image + (size_t)y * st, (size_t)k * st, 0);
+		}
+	}
+	if (tail_len) yhk_out_add(io, &o, tail, tail_len, 1);
+	yhk_out_flush(io, &o);
+	return blank;
+}
+
+/* drops what is left of a reply to a query that timed out */
+static void yhk_drain(btio_t *io) {
+	uint8_t buf[64];
+	struct pollfd fds = { 0 };
+	fds.fd = io->sock;
+	fds.events = POLLIN;
+	while (poll(&fds, 1, 0) > 0 && fds.revents & POLLIN)
+		if (read(io->sock, buf, sizeof(buf)) <= 0) break;
+}
+
+/*
+ * Returns the printer error code (0 - ok, 2 - no paper) or -1 on timeout.
+ * A late reply to an earlier query is skipped up to the "err:" prefix.
+ */
+static int yhk_status(btio_t *io) {
+	static const uint8_t cmd[] = { 0x1d,0x67,0x53 };
+	uint8_t buf[6];
+	int n = 0, ret;
+	yhk_drain(io);
+	bt_send(io, cmd, 3);
+	while (n < 6) {
+		struct pollfd fds = { 0 };
+		fds.fd = io->sock;
+		fds.events = POLLIN;
+		ret = poll(&fds, 1, io->timeout);
+		if (ret < 0) {
+			if (errno == EINTR && !bt_stop) continue;
+			return -1;
+		}
+		if (!ret) return -1;
+		ret = read(io->sock, buf + n, 6 - n);
+		if (ret <= 0) ERR_EXIT("read failed\n");
+		n += ret;
+		while (n && memcmp(buf, "err:", n < 4 ? n : 4))
+			memmove(buf, buf + 1, --n);
+	}
+	if (memcmp(buf, "err:", 4) || buf[5] != '.')
+		ERR_EXIT("unexpected response\n");
+	return buf[4];
+}
+
+static void yhk_print_state(const char *s) {
+	out_begin("printer", NULL);
+	out_str("state", "printer: %s\n", (const uint8_t*)s, strlen(s));
+	out_end(NULL);
+}
+
+/* waits until at most "limit" bytes are queued in the socket */
+static void yhk_wait_queue(btio_t *io, int limit) {
+	int n;
+	while (!bt_stop && ioctl(io->sock, TIOCOUTQ, &n) == 0 && n > limit)
+		usleep(YHK_POLL_US);
+}
+
+/*
+ * Prints the image in bands of "band" rows, each with its own raster
+ * command, reading the next band from the image while the printer
+ * takes the previous one, so only one band is kept in memory.
+ * Before each band the socket queue is let to drain to one band and
+ * the status is checked; the printer answers after parsing the data
+ * before the query, so it also limits the data in flight.
+ * On "no paper" it waits for the paper, polling every second.
+ * Returns the number of rows sent, "time" gets the time until the
+ * printer took the last band, without the pauses, "blank" the number
+ * of blank rows sent as paper feed.
+ */
+static unsigned yhk_print_bands(btio_t *io, pnm_img_t *img, unsigned st,
+		unsigned height, unsigned band, uint64_t *time, unsigned *blank) {
+	static const uint8_t tail[] = { 0x0a,0x0a,0x0a,0x0a };
+	uint64_t t0 = get_time_us(), wait = 0;
+	unsigned y = 0, k = 0;
+	uint8_t *buf = malloc((size_t)band * st);
+	int paused = 0;
+	if (!buf) ERR_EXIT("malloc failed\n");
+	*blank = 0;
+	bt_catch_stop();
+	while (y < height && !bt_stop) {
+		int err;
+		if (!k) {
+			k = height - y < band ? height - y : band;
+			k = pnm_img_rows(img, buf, k, st);
+			if (!k) {
+				DBG_LOG("image truncated at row %u\n", y);
+				break;
+			}
+		}
+		if (y) {
+			yhk_wait_queue(io, band * st);
+			err = yhk_status(io);
+			if (err == 2) {
+				uint64_t t = get_time_us();
+				if (!paused++) yhk_print_state("no paper, paused");
+				sleep(1);
+				wait += get_time_us() - t;
+				continue;
+			}
+			if (err < 0) DBG_LOG("status timeout\n");
+			else if (err) DBG_LOG("printer error %d\n", err);
+			if (paused) yhk_print_state("resumed");
+			paused = 0;
+		}
+		*blank += yhk_send_raster(io, buf, st, k,
+				y + k == height ? tail : NULL, y + k == height ? sizeof(tail) : 0);
+		y += k;
+		k = 0;
+	}
+	free(buf);
+	if (y < height) bt_send(io, tail, sizeof(tail));
+	yhk_wait_queue(io, 0);
+	yhk_status(io);
+	*time = get_time_us() - t0 - wait;
+	return y;
 }
 
 static void yhk_print_main(btio_t *io, int argc, char **argv) {
 	uint8_t buf[256];
 	int yhk_width = 384;
+	unsigned yhk_band = YHK_BAND;
+	int yhk_dither = DITHER_FS;
 
 	while (argc > 1) {
 		if (!strcmp(argv[1], "verbose")) {
@@ -52,24 +263,23 @@ static void yhk_print_main(btio_t *io, int argc, char **argv) {
 			bt_send(io, cmd, 3);
 			len = yhk_print_readstr(io, buf, sizeof(buf));
 			if (len < 0) ERR_EXIT("readstr failed\n");
-			fprintf(stderr, "serial: \"");
-			print_esc_str(stderr, buf, len);
-			fprintf(stderr, "\"\n");
+			out_begin("serial", NULL);
+			out_str("serial", "serial: \"%s\"\n", buf, len);
+			out_end(NULL);
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "err")) {
-			static const uint8_t cmd[] = { 0x1d,0x67,0x53 };
 			const char *s = "unknown";
-			bt_send(io, cmd, 3);
-			if (read(io->sock, buf, 6) != 6)
-				ERR_EXIT("read failed\n");
-			if (memcmp(buf, "err:", 4) || buf[5] != '.')
-				ERR_EXIT("unexpected response\n");
-			switch (buf[4]) {
+			int err = yhk_status(io);
+			if (err < 0) ERR_EXIT("read failed\n");
+			switch (err) {
 			case 0: s = "ok"; break;
 			case 2: s = "no paper"; break;
 			}
-			fprintf(stderr, "error: %u (%s)\n", buf[4], s);
+			out_begin("error", NULL);
+			out_int("error", "error: %u", err);
+			out_str("status", " (%s)\n", (const uint8_t*)s, strlen(s));
+			out_end(NULL);
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "info")) {
@@ -80,9 +290,9 @@ static void yhk_print_main(btio_t *io, int argc, char **argv) {
 			if (len < 0) ERR_EXIT("readstr failed\n");
 			/* dumb logic from the application code */
 			if (!strstr((char*)buf, "DPI=384,")) yhk_width = 576;
-			fprintf(stderr, "info: \"");
-			print_esc_str(stderr, buf, len);
-			fprintf(stderr, "\"\n");
+			out_begin("info", NULL);
+			out_str("info", "info: \"%s\"\n", buf, len);
+			out_end(NULL);
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "dpi")) {
@@ -92,42 +302,55 @@ static void yhk_print_main(btio_t *io, int argc, char **argv) {
 				ERR_EXIT("unexpected DPI\n");
 			argc -= 2; argv += 2;
 
+		} else if (!strcmp(argv[1], "band")) {
+			if (argc <= 2) ERR_EXIT("bad command\n");
+			yhk_band = atoi(argv[2]);
+			if (!yhk_band || yhk_band > 0xffff) ERR_EXIT("bad band size\n");
+			argc -= 2; argv += 2;
+
+		} else if (!strcmp(argv[1], "dither")) {
+			if (argc <= 2) ERR_EXIT("bad command\n");
+			if (!strcmp(argv[2], "fs")) yhk_dither = DITHER_FS;
+			else if (!strcmp(argv[2], "ordered")) yhk_dither = DITHER_ORDERED;
+			else ERR_EXIT("unknown dithering\n");
+			argc -= 2; argv += 2;
+
 		} else if (!strcmp(argv[1], "id")) {
 			static const uint8_t cmd[] = { 0x1d,0x67,0x69 };
 			int len;
 			bt_send(io, cmd, 3);
 			len = yhk_print_readstr(io, buf, sizeof(buf));
 			if (len < 0) ERR_EXIT("readstr failed\n");
-			fprintf(stderr, "id: \"");
-			print_esc_str(stderr, buf, len);
-			fprintf(stderr, "\"\n");
+			out_begin("id", NULL);
+			out_str("id", "id: \"%s\"\n", buf, len);
+			out_end(NULL);
 			argc -= 1; argv += 1;
 
 		} else if (!strcmp(argv[1], "print")) {
 			uint8_t cmd1[] = { 0x1d,0x49,0xf0, 0 };
 			static const uint8_t cmd2[] = { 0x1b,0x40 };
-			uint8_t cmd3[] = { 0x1d,0x76,0x30,0, 0,0,0,0 };
-			static const uint8_t cmd4[] = { 0x0a,0x0a,0x0a,0x0a };
-			unsigned y, height, st;
-			uint8_t *image;
+			unsigned st, rows, blank;
+			uint64_t t, bytes = bt_counters.tx_bytes;
+			pnm_img_t img;
 			if (argc <= 2) ERR_EXIT("bad command\n");
-			image = yhk_print_read_pbm(argv[2], yhk_width, &height);
-			if (!image) ERR_EXIT("read_pbm failed\n");
+			if (pnm_img_open(&img, argv[2], yhk_width, yhk_dither))
+				ERR_EXIT("read_pnm failed\n");
 
 			cmd1[3] = 0x19; // unknown setting
 			bt_send(io, cmd1, 4);
 			bt_send(io, cmd2, 2);
-			//usleep(500000); // 0.5s wait
 
 			st = (yhk_width + 7) >> 3;
-			cmd3[4] = st;
-			cmd3[6] = height;
-			cmd3[7] = height >> 8;
-			bt_send(io, cmd3, 8);
-			for (y = 0; y < height; y++)
-				bt_send(io, image + y * st, st);
-			bt_send(io, cmd4, 4);
-			free(image);
+			rows = yhk_print_bands(io, &img, st, img.height, yhk_band, &t, &blank);
+			pnm_img_close(&img);
+			bytes = bt_counters.tx_bytes - bytes;
+			out_begin("print", NULL);
+			out_int("rows", "printed %u rows", rows);
+			out_int("blank", " (%u blank)", blank);
+			out_int("bytes", ", %u bytes", bytes);
+			out_fix("dur", " in %d.%03us", (t + 500) / 1000, 3);
+			out_int("rate", " (%u rows/s)\n", t ? rows * 1000000ull / t : 0);
+			out_end(NULL);
 			argc -= 2; argv += 2;
 
 		} else if (!strcmp(argv[1], "timeout")) {